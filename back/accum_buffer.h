@@ -0,0 +1,150 @@
+#pragma once
+
+// Running sums of a frame's samples, from which the image and its noise are
+// read back.
+//
+// Every pixel keeps one RGB sum per 2x2 subpixel, the sum and sum of squares
+// of its samples' luminance, and how many samples each of its subpixels has
+// taken. Samples are numbered per pixel, so a pixel at count n continues with
+// sample n whichever pass, tile or thread renders it next.
+//
+// A rectangle of the buffer travels between replicas in a packed binary form:
+// a header of ten uint32 (magic "ACCB", version, frame width and height, the
+// rectangle's x0, y0, x1, y1, the first sample its sums hold and a tag naming
+// what was rendered), then per pixel row by row its count, 12 sums and lum,
+// lum2, all in host byte order. A pixel's sums hold its samples first to
+// first + count - 1, so frames that split a pixel's samples between them add
+// up to the frame that took them all.
+
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+struct AccumBuffer {
+    int w = 0, h = 0;
+    std::vector<float> sum;        // 4 subpixels x RGB per pixel, pixel y * w + x
+    std::vector<double> lum, lum2; // per pixel, over all its subpixels' samples
+    std::vector<uint32_t> count;   // samples per subpixel, per pixel
+
+    AccumBuffer() = default;
+    AccumBuffer(int w_, int h_) : w(w_), h(h_), sum(size_t(w_) * h_ * 12), lum(size_t(w_) * h_),
+                                  lum2(size_t(w_) * h_), count(size_t(w_) * h_) {}
+
+    // Adds one sample of subpixel sub; the caller bumps count once all four
+    // subpixels have their samples
+    void add(int pixel, int sub, double r, double g, double b) {
+        float *s = &sum[size_t(pixel) * 12 + sub * 3];
+        s[0] += float(r), s[1] += float(g), s[2] += float(b);
+        double y = .2126 * r + .7152 * g + .0722 * b;
+        lum[pixel] += y;
+        lum2[pixel] += y * y;
+    }
+
+    // Standard error of the pixel's mean luminance relative to that mean,
+    // with means below floor judged against floor. HUGE_VAL below 2 samples.
+    double relError(int pixel, double floor) const {
+        double n = 4. * count[pixel];
+        if (n < 2) return HUGE_VAL;
+        double mean = lum[pixel] / n, var = std::max(0., (lum2[pixel] - lum[pixel] * mean) / (n - 1));
+        return sqrt(var / n) / std::max(mean, floor);
+    }
+
+    // Zeroes the pixels of [x0, x1) x [y0, y1)
+    void clearRect(int x0, int y0, int x1, int y1) {
+        for (int y = y0; y < y1; y++) {
+            size_t p0 = size_t(y) * w + x0, p1 = size_t(y) * w + x1;
+            std::fill(sum.begin() + p0 * 12, sum.begin() + p1 * 12, 0.f);
+            std::fill(lum.begin() + p0, lum.begin() + p1, 0.);
+            std::fill(lum2.begin() + p0, lum2.begin() + p1, 0.);
+            std::fill(count.begin() + p0, count.begin() + p1, 0u);
+        }
+    }
+
+    // Packed form of [x0, x1) x [y0, y1); see above for first and tag
+    std::string pack(int x0, int y0, int x1, int y1, uint32_t first = 0, uint32_t tag = 0) const {
+        const uint32_t header[kHeaderWords] = {kMagic, kVersion, uint32_t(w), uint32_t(h), uint32_t(x0),
+                                               uint32_t(y0), uint32_t(x1), uint32_t(y1), first, tag};
+        std::string out;
+        out.reserve(packedBytes(x1 - x0, y1 - y0));
+        out.append(reinterpret_cast<const char*>(header), sizeof(header));
+        for (int y = y0; y < y1; y++)
+            for (int x = x0; x < x1; x++) {
+                size_t p = size_t(y) * w + x;
+                out.append(reinterpret_cast<const char*>(&count[p]), sizeof(uint32_t));
+                out.append(reinterpret_cast<const char*>(&sum[p * 12]), 12 * sizeof(float));
+                out.append(reinterpret_cast<const char*>(&lum[p]), sizeof(double));
+                out.append(reinterpret_cast<const char*>(&lum2[p]), sizeof(double));
+            }
+        return out;
+    }
+
+    static size_t packedBytes(int w, int h) { return kHeaderWords * sizeof(uint32_t) + size_t(w) * h * kPixelBytes; }
+
+    // Writes packed pixels over [x0, x1) x [y0, y1) of this buffer. Returns
+    // false, leaving the buffer as it was, unless data is exactly that
+    // rectangle of a frame this size, with first and tag 0.
+    bool unpack(const std::string& data, int x0, int y0, int x1, int y1) {
+        const uint32_t header[kHeaderWords] = {kMagic, kVersion, uint32_t(w), uint32_t(h), uint32_t(x0),
+                                               uint32_t(y0), uint32_t(x1), uint32_t(y1), 0, 0};
+        if (data.size() != packedBytes(x1 - x0, y1 - y0) ||
+            memcmp(data.data(), header, sizeof(header)) != 0) {
+            return false;
+        }
+        const char* in = data.data() + sizeof(header);
+        for (int y = y0; y < y1; y++)
+            for (int x = x0; x < x1; x++) {
+                size_t p = size_t(y) * w + x;
+                memcpy(&count[p], in, sizeof(uint32_t));
+                memcpy(&sum[p * 12], in + 4, 12 * sizeof(float));
+                memcpy(&lum[p], in + 52, sizeof(double));
+                memcpy(&lum2[p], in + 60, sizeof(double));
+                in += kPixelBytes;
+            }
+        return true;
+    }
+
+    // Adds a packed whole frame of this size to the buffer, sums and counts
+    // alike. Returns false, leaving the buffer as it was, for anything else;
+    // first and tag receive the frame's header fields.
+    bool addPacked(const std::string& data, uint32_t& first, uint32_t& tag) {
+        uint32_t header[kHeaderWords];
+        if (data.size() != packedBytes(w, h)) return false;
+        memcpy(header, data.data(), sizeof(header));
+        if (header[0] != kMagic || header[1] != kVersion || header[2] != uint32_t(w) || header[3] != uint32_t(h) ||
+            header[4] != 0 || header[5] != 0 || header[6] != uint32_t(w) || header[7] != uint32_t(h)) {
+            return false;
+        }
+        first = header[8];
+        tag = header[9];
+        const char* in = data.data() + sizeof(header);
+        for (size_t p = 0; p < size_t(w) * h; p++, in += kPixelBytes) {
+            uint32_t n;
+            float s[12];
+            double l[2];
+            memcpy(&n, in, sizeof(n));
+            memcpy(s, in + 4, sizeof(s));
+            memcpy(l, in + 52, sizeof(l));
+            count[p] += n;
+            for (int k = 0; k < 12; k++) sum[p * 12 + k] += s[k];
+            lum[p] += l[0];
+            lum2[p] += l[1];
+        }
+        return true;
+    }
+
+    uint64_t totalSamples() const {
+        uint64_t total = 0;
+        for (uint32_t n : count) total += n;
+        return total;
+    }
+
+private:
+    static const uint32_t kMagic = 0x42434341; // "ACCB" read as little-endian
+    static const uint32_t kVersion = 1;
+    static const int kHeaderWords = 10;
+    static const size_t kPixelBytes = sizeof(uint32_t) + 12 * sizeof(float) + 2 * sizeof(double);
+};
@@ -0,0 +1,107 @@
+#pragma once
+
+// Process-wide store of accumulation buffers, so a request can continue a
+// frame an earlier request started instead of rendering it from scratch.
+//
+// Buffers are keyed by everything that decides a sample's value (scene, seed,
+// sampler, integrator settings). A render takes its key's buffer out of the
+// store, adds samples and puts it back; a concurrent render of the same key
+// meanwhile starts its own buffer, and when both come back the one holding
+// more samples is kept. Least recently used buffers are evicted to stay
+// within the memory budget.
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "accum_buffer.h"
+
+class AccumStore {
+public:
+    struct Stats {
+        size_t entries;
+        size_t bytes;
+        size_t capacityBytes;
+        unsigned long long hits;      // take() found a buffer
+        unsigned long long misses;
+        unsigned long long evictions;
+    };
+
+    explicit AccumStore(size_t capacityBytes) : capacity_(capacityBytes) {}
+
+    AccumStore(const AccumStore&) = delete;
+    AccumStore& operator=(const AccumStore&) = delete;
+
+    // Sizes the store from RENDER_ACCUM_MB (default: 512; 0 disables it)
+    static AccumStore* fromEnv() {
+        size_t mb = 512;
+        if (const char* v = getenv("RENDER_ACCUM_MB")) mb = size_t(std::max(0, atoi(v)));
+        return new AccumStore(mb << 20);
+    }
+
+    static size_t bytesOf(const AccumBuffer& acc) {
+        return acc.sum.size() * sizeof(float) + (acc.lum.size() + acc.lum2.size()) * sizeof(double) +
+               acc.count.size() * sizeof(uint32_t);
+    }
+
+    // Removes and returns key's buffer, or null when there is none
+    std::unique_ptr<AccumBuffer> take(const std::string& key) {
+        std::lock_guard<std::mutex> lk(m_);
+        auto it = index_.find(key);
+        if (it == index_.end()) {
+            misses_++;
+            return nullptr;
+        }
+        hits_++;
+        std::unique_ptr<AccumBuffer> acc = std::move(it->second->second);
+        bytes_ -= bytesOf(*acc);
+        lru_.erase(it->second);
+        index_.erase(it);
+        return acc;
+    }
+
+    // Stores acc under key as the most recently used entry, unless the entry
+    // already there holds at least as many samples
+    void put(const std::string& key, std::unique_ptr<AccumBuffer> acc) {
+        size_t size = bytesOf(*acc);
+        std::lock_guard<std::mutex> lk(m_);
+        if (size > capacity_) return;
+        auto it = index_.find(key);
+        if (it != index_.end()) {
+            if (it->second->second->totalSamples() >= acc->totalSamples()) return;
+            bytes_ -= bytesOf(*it->second->second);
+            lru_.erase(it->second);
+            index_.erase(it);
+        }
+        while (bytes_ + size > capacity_ && !lru_.empty()) {
+            bytes_ -= bytesOf(*lru_.back().second);
+            index_.erase(lru_.back().first);
+            lru_.pop_back();
+            evictions_++;
+        }
+        lru_.emplace_front(key, std::move(acc));
+        index_[key] = lru_.begin();
+        bytes_ += size;
+    }
+
+    Stats stats() const {
+        std::lock_guard<std::mutex> lk(m_);
+        return {index_.size(), bytes_, capacity_, hits_, misses_, evictions_};
+    }
+
+private:
+    using Entry = std::pair<std::string, std::unique_ptr<AccumBuffer>>;
+
+    mutable std::mutex m_;
+    std::list<Entry> lru_; // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    size_t capacity_;
+    size_t bytes_ = 0;
+    unsigned long long hits_ = 0, misses_ = 0, evictions_ = 0;
+};
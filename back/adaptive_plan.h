@@ -0,0 +1,63 @@
+#pragma once
+
+// Adaptive sampling: every pixel first takes kAdaptiveFirst samples per
+// subpixel, then passes double the count of pixels whose 3x3 neighbourhood is
+// still noisier than the noise threshold (see AccumBuffer::relError(); means
+// below kNoiseFloor are judged against it) until they reach maxSamples or the
+// frame has spent samples per pixel on average.
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "accum_buffer.h"
+
+const int kAdaptiveFirst = 4;
+const double kNoiseFloor = .05;
+
+// Sets target to the sample counts of the next adaptive pass, at most limit
+// samples in all. Returns false when no pixel needs, or the budget allows,
+// another sample.
+inline bool planAdaptivePass(const AccumBuffer &acc, uint32_t samples, uint32_t maxSamples, double noise,
+                             uint64_t limit, std::vector<uint32_t> &target) {
+    int w = acc.w, h = acc.h;
+    uint64_t budget = uint64_t(samples) * w * h, spent = acc.totalSamples();
+    if (spent >= budget) return false;
+    limit = std::min(limit, budget - spent);
+
+    std::vector<double> err(size_t(w) * h);
+    for (int p = 0; p < w * h; p++) err[p] = acc.relError(p, kNoiseFloor);
+    uint64_t wanted = 0;
+    for (int y = 0; y < h; y++)
+        for (int x = 0; x < w; x++) {
+            int p = y * w + x;
+            uint32_t n = acc.count[p];
+            target[p] = n;
+            if (n >= maxSamples) continue;
+            double worst = 0;
+            for (int j = std::max(0, y - 1); j <= std::min(h - 1, y + 1); j++)
+                for (int i = std::max(0, x - 1); i <= std::min(w - 1, x + 1); i++) worst = std::max(worst, err[j * w + i]);
+            if (worst <= noise) continue;
+            target[p] = n + std::min(std::max(n, 1u), maxSamples - n);
+            wanted += target[p] - n;
+        }
+    if (wanted == 0) return false;
+
+    // Scale the pass down to what is left of the budget. Pixels usually ask
+    // for a few samples each, which scaled alone would round to none; the
+    // fraction each leaves over carries to the next, so the pass still spends
+    // the whole limit.
+    if (wanted > limit) {
+        double scale = double(limit) / wanted, carry = 0;
+        wanted = 0;
+        for (int p = 0; p < w * h; p++) {
+            double share = (target[p] - acc.count[p]) * scale + carry;
+            uint32_t k = uint32_t(share);
+            carry = share - k;
+            target[p] = acc.count[p] + k;
+            wanted += k;
+        }
+    }
+    return wanted > 0;
+}
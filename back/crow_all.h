@@ -8390,7 +8390,10 @@ namespace crow
                 }
                 if (complete_request_handler_)
                 {
-                    complete_request_handler_();
+                    // Keep the handler (and the connection it owns) alive until it returns:
+                    // when end() is called asynchronously it may hold the last reference.
+                    auto handler = std::move(complete_request_handler_);
+                    handler();
                     manual_length_header = false;
                     skip_body = false;
                 }
@@ -8404,6 +8407,18 @@ namespace crow
             end();
         }
 
+        /// Send body_part right away as a chunk of a chunked response, the headers set so far before the first one.
+
+        ///
+        /// end() then sends the rest of the body and the last chunk. Call on the connection's I/O thread.
+        void write_chunk(const std::string& body_part)
+        {
+            if (!completed_ && chunk_handler_)
+            {
+                chunk_handler_(body_part);
+            }
+        }
+
         /// Check if the connection is still alive (usually by checking the socket status).
         bool is_alive()
         {
@@ -8464,6 +8479,7 @@ namespace crow
     private:
         bool completed_{};
         std::function<void()> complete_request_handler_;
+        std::function<void(const std::string&)> chunk_handler_;
         std::function<bool()> is_alive_helper_;
         static_file_info file_info;
     };
@@ -9952,6 +9968,7 @@ namespace crow
 #include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <deque>
 #include <memory>
 #include <vector>
 
@@ -10125,6 +10142,9 @@ namespace crow
                     res.complete_request_handler_ = [self] {
                         self->complete_request();
                     };
+                    res.chunk_handler_ = [self](const std::string& part) {
+                        self->write_chunk(part);
+                    };
                     need_to_call_after_handlers_ = true;
                     handler_->handle(req_, res, routing_handle_result_);
                     if (add_keep_alive_)
@@ -10141,11 +10161,48 @@ namespace crow
             }
         }
 
+        /// Queue part as a chunk of a chunked response, and the headers before the first one.
+
+        ///
+        /// Chunks go out in order with async_write, so a slow reader never blocks the I/O thread.
+        void write_chunk(const std::string& part)
+        {
+            if (!adaptor_.is_open())
+            {
+                return;
+            }
+            if (!chunked_)
+            {
+                chunked_ = true;
+                res.set_header("Transfer-Encoding", "chunked");
+                res.manual_length_header = true;
+                auto complete = std::move(res.complete_request_handler_);
+                auto alive = std::move(res.is_alive_helper_);
+                prepare_buffers();
+                res.complete_request_handler_ = std::move(complete);
+                res.is_alive_helper_ = std::move(alive);
+                std::string headers;
+                for (const auto& buffer : buffers_)
+                {
+                    headers.append(static_cast<const char*>(buffer.data()), buffer.size());
+                }
+                buffers_.clear();
+                queue_chunk(std::move(headers));
+            }
+            if (!part.empty())
+            {
+                std::ostringstream chunk;
+                chunk << std::hex << part.size() << crlf << part << crlf;
+                queue_chunk(chunk.str());
+            }
+        }
+
         /// Call the after handle middleware and send the write the response to the connection.
         void complete_request()
         {
             CROW_LOG_INFO << "Response: " << this << ' ' << req_.raw_url << ' ' << res.code << ' ' << close_connection_;
             res.is_alive_helper_ = nullptr;
+            res.chunk_handler_ = nullptr;
 
             if (need_to_call_after_handlers_)
             {
@@ -10187,6 +10244,22 @@ namespace crow
             }
 #endif
 
+            if (chunked_)
+            {
+                // Headers went out with the first chunk; the rest of the body is the last one
+                chunked_ = false;
+                res.complete_request_handler_ = nullptr;
+                std::ostringstream last;
+                if (!res.body.empty())
+                {
+                    last << std::hex << res.body.size() << crlf << res.body << crlf;
+                }
+                last << "0" << crlf << crlf;
+                chunks_finishing_ = true;
+                queue_chunk(last.str());
+                return;
+            }
+
             prepare_buffers();
 
             if (res.is_static_type())
@@ -10318,6 +10391,64 @@ namespace crow
             buffers_.emplace_back(crlf.data(), crlf.size());
         }
 
+        void queue_chunk(std::string data)
+        {
+            chunks_.push_back(std::move(data));
+            if (chunks_.size() == 1)
+            {
+                do_write_chunk();
+            }
+        }
+
+        void do_write_chunk()
+        {
+            if (chunks_.empty())
+            {
+                if (chunks_finishing_)
+                {
+                    finish_chunked();
+                }
+                return;
+            }
+            auto self = this->shared_from_this();
+            asio::async_write(
+              adaptor_.socket(), asio::buffer(chunks_.front()),
+              [self](const error_code& ec, std::size_t /*bytes_transferred*/) {
+                  if (ec)
+                  {
+                      CROW_LOG_DEBUG << self << " from write (chunk): " << ec.message();
+                      self->adaptor_.shutdown_readwrite();
+                      self->adaptor_.close();
+                      self->chunks_.clear();
+                  }
+                  else
+                  {
+                      self->chunks_.pop_front();
+                  }
+                  self->do_write_chunk();
+              });
+        }
+
+        /// After the last chunk: the same as after any other response
+        void finish_chunked()
+        {
+            chunks_finishing_ = false;
+            res.clear();
+            parser_.clear();
+            if (close_connection_)
+            {
+                adaptor_.shutdown_readwrite();
+                adaptor_.close();
+                CROW_LOG_DEBUG << this << " from write (chunked)";
+            }
+            else if (need_to_start_read_after_complete_)
+            {
+                need_to_start_read_after_complete_ = false;
+                start_deadline();
+                do_read();
+            }
+        }
+
         void do_write_static()
         {
             asio::write(adaptor_.socket(), buffers_);
@@ -10542,6 +10673,9 @@ namespace crow
         bool need_to_call_after_handlers_{};
         bool need_to_start_read_after_complete_{};
         bool add_keep_alive_{};
+        bool chunked_{};
+        bool chunks_finishing_{};
+        std::deque<std::string> chunks_; ///< Chunks of a chunked response waiting to be written, the one being written first
 
         std::tuple<Middlewares...>* middlewares_;
         detail::context<Middlewares...> ctx_;
@@ -10980,6 +11114,8 @@ namespace crow // NOTE: Already documented in "crow/app.h"
             virtual void close(std::string const& msg = "quit", uint16_t status_code = CloseStatusCode::NormalClosure) = 0;
             virtual std::string get_remote_ip() = 0;
             virtual std::string get_subprotocol() const = 0;
+            /// Payload bytes of messages sent but not yet written to the socket; safe from any thread.
+            virtual size_t buffered_amount() const = 0;
             virtual ~connection() = default;
 
             void userdata(void* u) { userdata_ = u; }
@@ -11195,6 +11331,11 @@ namespace crow // NOTE: Already documented in "crow/app.h"
                 return adaptor_.address();
             }
 
+            size_t buffered_amount() const override
+            {
+                return buffered_amount_;
+            }
+
             void set_max_payload_size(uint64_t payload)
             {
                 max_payload_bytes_ = payload;
@@ -11633,6 +11774,8 @@ namespace crow // NOTE: Already documented in "crow/app.h"
                 if (sending_buffers_.empty())
                 {
                     sending_buffers_.swap(write_buffers_);
+                    sending_payload_bytes_ = write_payload_bytes_;
+                    write_payload_bytes_ = 0;
                     std::vector<asio::const_buffer> buffers;
                     buffers.reserve(sending_buffers_.size());
                     for (auto& s : sending_buffers_)
@@ -11646,6 +11789,8 @@ namespace crow // NOTE: Already documented in "crow/app.h"
                           if (!ec && !close_connection_)
                           {
                               sending_buffers_.clear();
+                              buffered_amount_ -= sending_payload_bytes_;
+                              sending_payload_bytes_ = 0;
                               if (!write_buffers_.empty())
                                   do_write();
                               if (has_sent_close_)
@@ -11692,6 +11837,7 @@ namespace crow // NOTE: Already documented in "crow/app.h"
 
             void send_data_impl(SendMessageType* s)
             {
+                write_payload_bytes_ += s->payload.size();
                 auto header = build_header(s->opcode, s->payload.size());
                 write_buffers_.emplace_back(std::move(header));
                 write_buffers_.emplace_back(std::move(s->payload));
@@ -11700,6 +11846,7 @@ namespace crow // NOTE: Already documented in "crow/app.h"
 
             void send_data(int opcode, std::string&& msg)
             {
+                buffered_amount_ += msg.size();
                 SendMessageType event_arg{
                   std::move(msg),
                   this,
@@ -11714,6 +11861,9 @@ namespace crow // NOTE: Already documented in "crow/app.h"
 
             std::vector<std::string> sending_buffers_;
             std::vector<std::string> write_buffers_;
+            std::atomic<size_t> buffered_amount_{0};
+            size_t sending_payload_bytes_{0}; ///< Message payload bytes in sending_buffers_
+            size_t write_payload_bytes_{0};   ///< ...and in write_buffers_
 
             std::array<char, 4096> buffer_;
             bool is_binary_;
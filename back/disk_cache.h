@@ -0,0 +1,258 @@
+#pragma once
+
+// Persistent second tier of the render cache.
+//
+// Every entry is one file, <hash>.bin after RenderCache::hash() of its
+// canonical key, holding exactly the encoded image in whatever format the key
+// names, so a hit can be handed to Crow's static file path and streamed from
+// disk without passing through the response body. A sidecar <hash>.key file
+// holds the canonical key, compared on lookup like the memory tier does. The
+// index is rebuilt from the directory at startup, least recently used (oldest
+// mtime) last, so a restarted replica comes up with the cache its predecessor
+// left. Files are written under a temporary name and renamed into place, so
+// readers and restarts never see half an entry. Eviction drops an entry from
+// the index at once but leaves its files in place for a grace period: Crow
+// opens a path some time after get() returned it. Files past it are unlinked
+// on the next get(), put() or stats(), whichever comes first.
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <fstream>
+#include <list>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "render_cache.h"
+
+class DiskCache {
+public:
+    struct Stats {
+        size_t entries;
+        size_t bytes;
+        size_t capacityBytes;
+        unsigned long long hits;
+        unsigned long long misses;
+        unsigned long long evictions;
+        unsigned long long writeErrors;
+    };
+
+    // An empty dir disables the cache. Evicted files are kept for grace.
+    DiskCache(std::string dir, size_t capacityBytes, std::chrono::milliseconds grace = kGrace)
+        : dir_(std::move(dir)), capacity_(capacityBytes), grace_(grace) {
+        if (!dir_.empty()) load();
+    }
+
+    DiskCache(const DiskCache&) = delete;
+    DiskCache& operator=(const DiskCache&) = delete;
+
+    // Places the cache in RENDER_CACHE_DIR (default: unset, disabled) with
+    // RENDER_CACHE_DISK_MB of room (default: 4096)
+    static DiskCache* fromEnv() {
+        const char* dir = getenv("RENDER_CACHE_DIR");
+        size_t mb = 4096;
+        if (const char* v = getenv("RENDER_CACHE_DISK_MB")) mb = size_t(std::max(0, atoi(v)));
+        return new DiskCache(dir && mb ? dir : "", mb << 20);
+    }
+
+    bool enabled() const { return !dir_.empty(); }
+
+    // Path of the file holding key's image, marked most recently used; empty
+    // on a miss
+    std::string get(const std::string& key) {
+        if (!enabled()) return "";
+        uint64_t h = RenderCache::hash(key);
+        std::lock_guard<std::mutex> lk(m_);
+        reap();
+        auto it = index_.find(h);
+        if (it == index_.end() || it->second->key != key) {
+            misses_++;
+            return "";
+        }
+        hits_++;
+        lru_.splice(lru_.begin(), lru_, it->second);
+        std::string path = pathOf(h, ".bin");
+        utimensat(AT_FDCWD, path.c_str(), nullptr, 0); // keeps the LRU order across restarts
+        return path;
+    }
+
+    void put(const std::string& key, const std::string& bytes) {
+        if (!enabled()) return;
+        size_t size = bytes.size() + key.size();
+        if (size > capacity_) return;
+        uint64_t h = RenderCache::hash(key);
+        std::string image = pathOf(h, ".bin"), keyFile = pathOf(h, ".key");
+        // Unique temporary names: concurrent puts of one key must not share them
+        char suffix[32];
+        snprintf(suffix, sizeof(suffix), ".%llu.tmp", tmpCounter_.fetch_add(1ull));
+        if (!writeFile(keyFile + suffix, key) || !writeFile(image + suffix, bytes)) {
+            unlink((keyFile + suffix).c_str());
+            unlink((image + suffix).c_str());
+            std::lock_guard<std::mutex> lk(m_);
+            writeErrors_++;
+            return;
+        }
+
+        std::lock_guard<std::mutex> lk(m_);
+        auto it = index_.find(h);
+        if (it != index_.end()) {
+            bytes_ -= it->second->size;
+            lru_.erase(it->second);
+            index_.erase(it);
+        }
+        // The key lands first: a .bin without its .key is dropped at load
+        rename((keyFile + suffix).c_str(), keyFile.c_str());
+        rename((image + suffix).c_str(), image.c_str());
+        lru_.push_front({h, key, size});
+        index_[h] = lru_.begin();
+        bytes_ += size;
+        while (bytes_ > capacity_ && lru_.size() > 1) {
+            const Entry& victim = lru_.back();
+            bytes_ -= victim.size;
+            retire(victim.hash);
+            index_.erase(victim.hash);
+            lru_.pop_back();
+            evictions_++;
+        }
+        reap();
+    }
+
+    Stats stats() const {
+        std::lock_guard<std::mutex> lk(m_);
+        reap(); // scraped regularly, so files go even when nothing is looked up
+        return {index_.size(), bytes_, capacity_, hits_, misses_, evictions_, writeErrors_};
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        uint64_t hash;
+        std::string key;
+        size_t size; // image and key bytes
+    };
+
+    // Evicted files stay this long before being unlinked
+    static constexpr std::chrono::seconds kGrace{30};
+
+    std::string pathOf(uint64_t h, const char* ext) const {
+        char name[32];
+        snprintf(name, sizeof(name), "/%016llx", (unsigned long long)h);
+        return dir_ + name + ext;
+    }
+
+    static bool writeFile(const std::string& path, const std::string& data) {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(data.data(), std::streamsize(data.size()));
+        out.close();
+        return bool(out);
+    }
+
+    // Queues the files of an entry just dropped from the index for reap()
+    void retire(uint64_t h) { graveyard_.push_back({Clock::now(), h}); }
+
+    // Unlinks the files of entries evicted over grace_ ago, unless they were
+    // put back meanwhile
+    void reap() const {
+        while (!graveyard_.empty() && Clock::now() - graveyard_.front().first > grace_) {
+            uint64_t h = graveyard_.front().second;
+            graveyard_.pop_front();
+            // Put back, or evicted again and due later
+            if (index_.count(h) || std::any_of(graveyard_.begin(), graveyard_.end(),
+                                               [h](const std::pair<Clock::time_point, uint64_t>& g) {
+                                                   return g.second == h;
+                                               }))
+                continue;
+            unlink(pathOf(h, ".bin").c_str());
+            unlink(pathOf(h, ".key").c_str());
+        }
+    }
+
+    // Rebuilds the index from dir_, creating it if needed
+    void load() {
+        mkdir(dir_.c_str(), 0755);
+        DIR* d = opendir(dir_.c_str());
+        if (!d) {
+            fprintf(stderr, "Render disk cache disabled: cannot open %s\n", dir_.c_str());
+            dir_.clear();
+            return;
+        }
+        struct Found {
+            uint64_t hash;
+            size_t size;
+            time_t mtime;
+            std::string key;
+        };
+        std::vector<Found> found;
+        std::vector<std::string> stale;
+        std::vector<uint64_t> keys; // hashes with a .key file
+        while (struct dirent* e = readdir(d)) {
+            std::string name = e->d_name;
+            bool hashed = name.size() == 20 && name.find_first_not_of("0123456789abcdef") == 16;
+            // Leftovers of interrupted writes, and entries named .png by older versions
+            if (name.find(".tmp") != std::string::npos || name.find(".evicted.") != std::string::npos ||
+                (hashed && name.compare(16, 4, ".png") == 0)) {
+                stale.push_back(dir_ + "/" + name);
+                continue;
+            }
+            if (!hashed) continue;
+            uint64_t h = strtoull(name.substr(0, 16).c_str(), nullptr, 16);
+            if (name.compare(16, 4, ".key") == 0) keys.push_back(h);
+            if (name.compare(16, 4, ".bin") != 0) continue;
+            std::ifstream in(pathOf(h, ".key"), std::ios::binary);
+            std::stringstream key;
+            key << in.rdbuf();
+            struct stat st;
+            if (!in || key.str().empty() || RenderCache::hash(key.str()) != h ||
+                stat(pathOf(h, ".bin").c_str(), &st) != 0) {
+                stale.push_back(pathOf(h, ".bin"));
+                stale.push_back(pathOf(h, ".key"));
+                continue;
+            }
+            found.push_back({h, size_t(st.st_size) + key.str().size(), st.st_mtime, key.str()});
+        }
+        closedir(d);
+        for (uint64_t h : keys) {
+            // A key whose image never landed
+            struct stat st;
+            if (stat(pathOf(h, ".bin").c_str(), &st) != 0) stale.push_back(pathOf(h, ".key"));
+        }
+        for (const std::string& path : stale) unlink(path.c_str());
+
+        std::sort(found.begin(), found.end(), [](const Found& a, const Found& b) { return a.mtime > b.mtime; });
+        for (const Found& f : found) {
+            if (bytes_ + f.size > capacity_) {
+                unlink(pathOf(f.hash, ".bin").c_str());
+                unlink(pathOf(f.hash, ".key").c_str());
+                continue;
+            }
+            lru_.push_back({f.hash, f.key, f.size});
+            index_[f.hash] = std::prev(lru_.end());
+            bytes_ += f.size;
+        }
+        fprintf(stderr, "Render disk cache: %zu entries, %zu bytes in %s\n", index_.size(), bytes_, dir_.c_str());
+    }
+
+    mutable std::mutex m_;
+    std::string dir_;
+    std::list<Entry> lru_; // most recently used first
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> index_;
+    mutable std::deque<std::pair<Clock::time_point, uint64_t>> graveyard_; // evicted, oldest first
+    std::atomic<unsigned long long> tmpCounter_{0};
+    size_t capacity_;
+    std::chrono::milliseconds grace_;
+    size_t bytes_ = 0;
+    unsigned long long hits_ = 0, misses_ = 0, evictions_ = 0, writeErrors_ = 0;
+};
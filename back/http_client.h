@@ -0,0 +1,111 @@
+#pragma once
+
+// Minimal blocking HTTP/1.1 client for talking to other replicas.
+//
+// One connection per request (Connection: close), plain http only, bodies
+// framed by Content-Length or the end of the connection. Enough for the
+// replica-to-replica calls this server makes; not a general client.
+
+#include <ctype.h>
+#include <netdb.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <string>
+
+namespace http_client {
+
+// http://host[:port][/prefix]
+struct Url {
+    std::string host, port = "80", prefix;
+};
+
+inline bool parseUrl(std::string url, Url& out) {
+    if (url.compare(0, 7, "http://") != 0) return false;
+    url.erase(0, 7);
+    size_t slash = url.find('/');
+    if (slash != std::string::npos) {
+        out.prefix = url.substr(slash);
+        while (!out.prefix.empty() && out.prefix.back() == '/') out.prefix.pop_back();
+        url.erase(slash);
+    }
+    size_t colon = url.rfind(':');
+    if (colon != std::string::npos) {
+        out.port = url.substr(colon + 1);
+        url.erase(colon);
+    }
+    out.host = url;
+    return !out.host.empty();
+}
+
+struct Response {
+    int status = 0;
+    std::string body;
+};
+
+// Sends method prefix+path with body and reads the whole response. Returns
+// false when the exchange failed; any HTTP status counts as success.
+inline bool request(const Url& url, const char* method, const std::string& path, const std::string& body,
+                    Response& out, int timeoutMs) {
+    addrinfo hints{}, *addrs = nullptr;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(url.host.c_str(), url.port.c_str(), &hints, &addrs) != 0) return false;
+    int fd = -1;
+    for (addrinfo* a = addrs; a && fd < 0; a = a->ai_next) {
+        fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0) continue;
+        timeval tv{timeoutMs / 1000, (timeoutMs % 1000) * 1000};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)); // bounds connect() too
+        if (connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addrs);
+    if (fd < 0) return false;
+
+    std::string msg = std::string(method) + " " + url.prefix + path + " HTTP/1.1\r\nHost: " + url.host +
+                      "\r\nConnection: close\r\nContent-Type: application/octet-stream\r\nContent-Length: " +
+                      std::to_string(body.size()) + "\r\n\r\n" + body;
+    for (size_t sent = 0; sent < msg.size();) {
+        ssize_t n = send(fd, msg.data() + sent, msg.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            close(fd);
+            return false;
+        }
+        sent += size_t(n);
+    }
+
+    std::string in;
+    char buf[16384];
+    size_t headerEnd = std::string::npos, length = std::string::npos;
+    for (;;) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n < 0) {
+            close(fd);
+            return false;
+        }
+        if (n == 0) break;
+        in.append(buf, size_t(n));
+        if (headerEnd == std::string::npos && (headerEnd = in.find("\r\n\r\n")) != std::string::npos) {
+            std::string headers = in.substr(0, headerEnd);
+            for (char& c : headers) c = char(tolower(c));
+            size_t cl = headers.find("\r\ncontent-length:");
+            if (cl != std::string::npos) length = strtoul(headers.c_str() + cl + 17, nullptr, 10);
+        }
+        if (headerEnd != std::string::npos && length != std::string::npos && in.size() >= headerEnd + 4 + length) break;
+    }
+    close(fd);
+    if (headerEnd == std::string::npos || in.compare(0, 5, "HTTP/") != 0) return false;
+    size_t space = in.find(' ');
+    out.status = atoi(in.c_str() + space + 1);
+    out.body = in.substr(headerEnd + 4, length);
+    return length == std::string::npos || out.body.size() == length;
+}
+
+} // namespace http_client
@@ -1,10 +1,27 @@
 #include <math.h>   // smallpt, a Path Tracer by Kevin Beason, 2008
 #include <stdio.h>  //        Remove "-fopenmp" for g++ version < 4.2
 #include <stdlib.h> // Make : g++ -O3 -fopenmp smallpt.cpp -o smallpt
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <sstream>
 #include <vector>
 
+#include "accum_buffer.h"
+#include "adaptive_plan.h"
+#include "accum_store.h"
 #include "crow_all.h"
+#include "disk_cache.h"
+#include "http_client.h"
+#include "png_encoder.h"
+#include "qoi_encoder.h"
+#include "render_cache.h"
+#include "render_pool.h"
+#include "sampler.h"
+#include "singleflight.h"
+#include "sphere_table.h"
+#include "tile_coordinator.h"
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
@@ -42,84 +59,278 @@ struct Sphere {
   Refl_t refl; // reflection type (DIFFuse, SPECular, REFRactive)
   Sphere(double rad_, Vec p_, Vec e_, Vec c_, Refl_t refl_)
       : rad(rad_), p(p_), e(e_), c(c_), refl(refl_) {}
-  double intersect(const Ray &r) const { // returns distance, 0 if nohit
-    Vec op = p - r.o; // Solve t^2*d.d + 2*t*(o-p).d + (o-p).(o-p)-R^2 = 0
-    double t, eps = 1e-4, b = op.dot(r.d), det = b * b - op.dot(op) + rad * rad;
-    if (det < 0)
-      return 0;
-    else
-      det = sqrt(det);
-    return (t = b - det) > eps ? t : ((t = b + det) > eps ? t : 0);
-  }
 };
 
-// Global spheres array - will be updated with parameters
-std::vector<Sphere> spheres;
+// An emissive sphere as NEE sees it. When the rest of the scene hides all of
+// it but the cap of points whose normal is within acos(cosCap) of axis, NEE
+// samples that cap by area; cosCap = -1 samples the whole sphere by cone.
+struct Light {
+  int id;
+  Vec axis;
+  double cosCap;
+};
+
+// Immutable scene description, built once per request and shared read-only by
+// every render thread working on that request
+struct Scene {
+  std::vector<Sphere> spheres; // geometry and materials, indexed by hit id
+  SphereTable table;           // SoA copy of the geometry used by intersect()
+  std::vector<Light> lights;   // emissive spheres sampled by NEE
+};
 
 inline double clamp(double x) { return x < 0 ? 0 : x > 1 ? 1 : x; }
 
 inline int toInt(double x) { return int(pow(clamp(x), 1 / 2.2) * 255 + .5); }
 
-inline bool intersect(const Ray &r, double &t, int &id) {
-  double n = spheres.size(), d, inf = t = 1e20;
-  for (int i = int(n); i--;)
-    if ((d = spheres[i].intersect(r)) && d < t) {
-      t = d;
-      id = i;
-    }
-  return t < inf;
+inline bool intersect(const Scene &scene, const Ray &r, double &t, int &id) {
+  const double o[3] = {r.o.x, r.o.y, r.o.z}, d[3] = {r.d.x, r.d.y, r.d.z};
+  return scene.table.intersect(o, d, t, id);
 }
 
-Vec radiance(const Ray &r, int depth, unsigned short *Xi) {
-  double t;   // distance to intersection
-  int id = 0; // id of intersected object
-  if (!intersect(r, t, id)) {
-    return Vec();                  // if miss, return black
+enum TileOrder { SCANLINE, MORTON, HILBERT }; // tile traversal order
+enum Engine { RECURSIVE, WAVEFRONT };         // integrator used for each tile
+
+// Per-request render settings that are not part of the scene
+struct RenderOptions {
+  int samples = 25;
+  int packet = 8; // camera rays traced together, 1 for single rays
+  int split = 2;  // bounces at which glass splits paths, at most kMaxSplit
+  bool nee = true; // sample the lights directly at DIFF hits
+  uint32_t seed = 0; // keys every random number together with pixel and sample
+  sampler::Kind samplerKind = sampler::SOBOL;
+  double noise = 0;   // relative noise at which adaptive sampling stops a pixel, 0 for uniform
+  int maxSamples = 0; // per-pixel ceiling of adaptive sampling
+  int budgetMs = 0;   // refine passes until this long after the request arrived, 0 for no deadline
+  std::chrono::steady_clock::time_point deadline;
+  int tileSize = 32;
+  TileOrder order = MORTON;
+  Engine engine = RECURSIVE;
+};
+
+// Sample dimensions of a path: the camera's, then kBounceDims per bounce
+enum CameraDim { kDimFilterX, kDimFilterY, kCameraDims };
+enum BounceDim { kDimRR, kDimLight, kDimLightU, kDimLightV, kDimBsdfU, kDimBsdfV, kDimGlass, kBounceDims };
+
+inline uint32_t bounceDim(int bounce, int dim) { return kCameraDims + bounce * kBounceDims + dim; }
+
+// Continuation ray off a DIFF or SPEC surface, DIFF sampled with (u1, u2);
+// REFR may branch, see step()
+inline Ray scatter(const Sphere &obj, const Ray &r, const Vec &x, const Vec &n, const Vec &nl,
+                   double u1, double u2) {
+  if (obj.refl == DIFF) { // Ideal DIFFUSE reflection
+    double r1 = 2 * M_PI * u1, r2 = u2, r2s = sqrt(r2);
+    Vec w = nl, u = ((fabs(w.x) > .1 ? Vec(0, 1) : Vec(1)) % w).norm(), v = w % u;
+    Vec d = (u * cos(r1) * r2s + v * sin(r1) * r2s + w * sqrt(1 - r2)).norm();
+    return Ray(x, d);
   }
-  const Sphere &obj = spheres[id]; // the hit object
+  return Ray(x, r.d - n * 2 * n.dot(r.d)); // Ideal SPECULAR reflection
+}
+
+// Everything radiance() needs to resume a path: the next ray to trace, the
+// throughput it carries and its bounce count
+struct PathState {
+  Ray r{Vec(), Vec()};
+  Vec thr;
+  int depth = 0;
+  double pdf = 0; // solid angle pdf r was sampled with, 0 if NEE cannot reach it
+};
+
+// Unit vector at polar angle acos(cosA) and azimuth phi around unit axis w
+inline Vec aroundAxis(Vec w, double cosA, double phi) {
+  Vec u = ((fabs(w.x) > .1 ? Vec(0, 1) : Vec(1)) % w).norm(), v = w % u;
+  double sinA = sqrt(std::max(0., 1 - cosA * cosA));
+  return (u * cos(phi) * sinA + v * sin(phi) * sinA + w * cosA).norm();
+}
+
+// Solid angle pdf with which sampleLights() picks the direction from x to the
+// point p on light
+inline double lightPdf(const Scene &scene, const Light &light, const Vec &x, const Vec &p) {
+  const Sphere &s = scene.spheres[light.id];
+  if (light.cosCap <= -1) { // uniform within the cone the sphere subtends
+    Vec d = s.p - x;
+    double d2 = d.dot(d), r2 = s.rad * s.rad;
+    if (d2 <= r2) return 0;
+    return 1 / (2 * M_PI * (1 - sqrt(1 - r2 / d2)));
+  }
+  Vec n = (p - s.p) * (1 / s.rad), d = p - x; // uniform over the cap's area
+  double d2 = d.dot(d), cosL = -n.dot(d) / sqrt(d2);
+  if (n.dot(light.axis) < light.cosCap || cosL <= 0) return 0;
+  return d2 / (cosL * 2 * M_PI * s.rad * s.rad * (1 - light.cosCap));
+}
+
+// Power heuristic weight of a strategy with pdf a against one with pdf b
+inline double misWeight(double a, double b) { return a * a / (a * a + b * b); }
+
+// Next event estimation at a DIFF hit x: one shadow ray towards a light
+// picked with u[0], to a point sampled with u[1], u[2] on its visible cap (or
+// within the cone it subtends), MIS-weighted against cosine sampling. Returns
+// the radiance reflected towards the viewer per unit of albedo.
+inline Vec sampleLights(const Scene &scene, const Vec &x, const Vec &nl, const double u[3]) {
+  int count = int(scene.lights.size());
+  if (count == 0) return Vec();
+  const Light &light = scene.lights[std::min(count - 1, int(u[0] * count))];
+  const Sphere &s = scene.spheres[light.id];
+  Vec l, p;
+  if (light.cosCap <= -1) {
+    Vec d = s.p - x;
+    double d2 = d.dot(d);
+    if (d2 <= s.rad * s.rad) return Vec();
+    l = aroundAxis(d * (1 / sqrt(d2)), 1 - u[1] * (1 - sqrt(1 - s.rad * s.rad / d2)), 2 * M_PI * u[2]);
+  } else {
+    p = s.p + aroundAxis(light.axis, 1 - u[1] * (1 - light.cosCap), 2 * M_PI * u[2]) * s.rad;
+    l = (p - x).norm();
+  }
+  double pl = lightPdf(scene, light, x, p) / count, cosT = l.dot(nl), t;
+  int hit;
+  if (pl == 0 || cosT <= 0 || !intersect(scene, Ray(x, l), t, hit) || hit != light.id) return Vec();
+  return s.e * (cosT * M_1_PI / pl * misWeight(pl, cosT * M_1_PI));
+}
+
+// MIS weight of emission found at p on sphere id by a ray from o sampled with
+// pdf; 1 unless NEE could have sampled the same point
+inline double emissionWeight(const Scene &scene, int id, const Vec &o, const Vec &p, double pdf) {
+  if (pdf <= 0) return 1;
+  for (const Light &light : scene.lights)
+    if (light.id == id) return misWeight(pdf, lightPdf(scene, light, o, p) / scene.lights.size());
+  return 1;
+}
+
+// Deepest bounce at which glass may split a path into both branches; it
+// bounds radiance()'s pending-branch stack
+const int kMaxSplit = 4;
+
+// Moves path across its hit (t, id): adds the emission picked up there, and
+// with opts.nee the light sampled from DIFF hits, to L and turns path into
+// the continuation. Returns false when the path ends. At a glass hit within
+// the first `split` bounces the reflected branch is pushed onto pending and
+// the path continues as the refracted one; deeper hits pick one branch by
+// Russian roulette. Random numbers come from rng's dimensions for this
+// bounce; a branch and its sibling share them.
+inline bool step(const Scene &scene, PathState &path, double t, int id, const Rng &rng,
+                 const RenderOptions &opts, Vec &L, PathState *pending, int &npending) {
+  const Sphere &obj = scene.spheres[id]; // the hit object
+  const Ray &r = path.r;
   Vec x = r.o + r.d * t, n = (x - obj.p).norm(),
       nl = n.dot(r.d) < 0 ? n : n * -1, f = obj.c;
   double p = f.x > f.y && f.x > f.z ? f.x : f.y > f.z ? f.y : f.z; // max refl
-  if (++depth > 5) {
-    if (erand48(Xi) < p) {
+  double we = opts.nee ? emissionWeight(scene, id, r.o, x, path.pdf) : 1;
+  L = L + path.thr.mult(obj.e) * we;
+  int bounce = path.depth;
+  if (++path.depth > 5) {
+    if (rng(bounceDim(bounce, kDimRR)) < p) {
       f = f * (1 / p);
     }
     else {
-      return obj.e;       // R.R.
+      return false;       // R.R.
     }
   }
-  if (obj.refl == DIFF) { // Ideal DIFFUSE reflection
-    double r1 = 2 * M_PI * erand48(Xi), r2 = erand48(Xi), r2s = sqrt(r2);
-    Vec w = nl, u = ((fabs(w.x) > .1 ? Vec(0, 1) : Vec(1)) % w).norm(), v = w % u;
-    Vec d = (u * cos(r1) * r2s + v * sin(r1) * r2s + w * sqrt(1 - r2)).norm();
-    return obj.e + f.mult(radiance(Ray(x, d), depth, Xi));
-  } else if (obj.refl == SPEC) { // Ideal SPECULAR reflection
-    return obj.e + f.mult(radiance(Ray(x, r.d - n * 2 * n.dot(r.d)), depth, Xi));
+  path.thr = path.thr.mult(f);
+  if (path.thr.x == 0 && path.thr.y == 0 && path.thr.z == 0) {
+    return false;         // nothing left to carry, e.g. off the light
+  }
+  if (obj.refl != REFR) {
+    if (obj.refl == DIFF && opts.nee) {
+      const double u[3] = {rng(bounceDim(bounce, kDimLight)), rng(bounceDim(bounce, kDimLightU)),
+                           rng(bounceDim(bounce, kDimLightV))};
+      L = L + path.thr.mult(sampleLights(scene, x, nl, u));
+    }
+    double u1 = obj.refl == DIFF ? rng(bounceDim(bounce, kDimBsdfU)) : 0;
+    double u2 = obj.refl == DIFF ? rng(bounceDim(bounce, kDimBsdfV)) : 0;
+    path.r = scatter(obj, r, x, n, nl, u1, u2);
+    path.pdf = obj.refl == DIFF ? path.r.d.dot(nl) * M_1_PI : 0;
+    return true;
   }
+  path.pdf = 0;
   Ray reflRay(x, r.d - n * 2 * n.dot(r.d)); // Ideal dielectric REFRACTION
   bool into = n.dot(nl) > 0;                // Ray from outside going in?
   double nc = 1, nt = 1.5, nnt = into ? nc / nt : nt / nc, ddn = r.d.dot(nl), cos2t;
   if ((cos2t = 1 - nnt * nnt * (1 - ddn * ddn)) < 0) { // Total internal reflection
-    return obj.e + f.mult(radiance(reflRay, depth, Xi));
+    path.r = reflRay;
+    return true;
   }
   Vec tdir = (r.d * nnt - n * ((into ? 1 : -1) * (ddn * nnt + sqrt(cos2t)))).norm();
   double a = nt - nc, b = nt + nc, R0 = a * a / (b * b),
          c = 1 - (into ? -ddn : tdir.dot(n));
   double Re = R0 + (1 - R0) * c * c * c * c * c, Tr = 1 - Re, P = .25 + .5 * Re,
          RP = Re / P, TP = Tr / (1 - P);
-  return obj.e +
-         f.mult(depth > 2
-                    ? (erand48(Xi) < P ? // Russian roulette
-                           radiance(reflRay, depth, Xi) * RP
-                                       : radiance(Ray(x, tdir), depth, Xi) * TP)
-                    : radiance(reflRay, depth, Xi) * Re +
-                          radiance(Ray(x, tdir), depth, Xi) * Tr);
-}
-
-void setupScene(double sphere1_x, double sphere1_y, double sphere1_z,
-                double sphere2_x, double sphere2_y, double sphere2_z) {
-    spheres.clear();
-    
+  if (path.depth <= std::min(opts.split, kMaxSplit)) {
+    pending[npending++] = PathState{reflRay, path.thr * Re, path.depth};
+    path.thr = path.thr * Tr;
+    path.r = Ray(x, tdir);
+  } else if (rng(bounceDim(bounce, kDimGlass)) < P) { // Russian roulette
+    path.thr = path.thr * RP;
+    path.r = reflRay;
+  } else {
+    path.thr = path.thr * TP;
+    path.r = Ray(x, tdir);
+  }
+  return true;
+}
+
+// Radiance carried back along path.r, weighted by path.thr. Iterative: the
+// only state besides path is a stack of at most opts.split pending glass
+// branches. Pass id >= 0 when the first hit (t, id) is already known.
+Vec radiance(const Scene &scene, PathState path, const Rng &rng, const RenderOptions &opts,
+             double t = 0, int id = -1) {
+  PathState pending[kMaxSplit];
+  int npending = 0;
+  Vec L;
+  bool hit = id >= 0 || intersect(scene, path.r, t, id);
+  for (;;) {
+    if (hit && step(scene, path, t, id, rng, opts, L, pending, npending)) {
+      hit = intersect(scene, path.r, t, id);
+      continue;
+    }
+    if (npending == 0) {
+      return L;
+    }
+    path = pending[--npending];
+    hit = intersect(scene, path.r, t, id);
+  }
+}
+
+// radiance() for the first n rays of a packet of camera rays. The camera hits
+// and the first bounce off DIFF and SPEC surfaces are intersected as packets;
+// lanes that hit glass branch and continue as single rays, as does every lane
+// after the first bounce. Lane l draws its random numbers from rng[l].
+void radiancePacket(const Scene &scene, const RayPacket &cam, int n, const Rng rng[],
+                    const RenderOptions &opts, Vec out[]) {
+  double t[RayPacket::kMax];
+  int id[RayPacket::kMax];
+  unsigned hits = intersectPacket(scene.table, cam, (1u << n) - 1, t, id);
+
+  RayPacket bounce{};
+  PathState paths[RayPacket::kMax];
+  unsigned bounced = 0;
+  for (int l = 0; l < n; l++) {
+    out[l] = Vec();
+    if (!(hits >> l & 1)) continue;
+    PathState path{Ray(Vec(cam.ox[l], cam.oy[l], cam.oz[l]), Vec(cam.dx[l], cam.dy[l], cam.dz[l])),
+                   Vec(1, 1, 1), 0};
+    if (scene.spheres[id[l]].refl == REFR) {
+      out[l] = radiance(scene, path, rng[l], opts, t[l], id[l]);
+      continue;
+    }
+    int npending = 0; // DIFF and SPEC never branch
+    if (!step(scene, path, t[l], id[l], rng[l], opts, out[l], nullptr, npending)) continue;
+    const double o[3] = {path.r.o.x, path.r.o.y, path.r.o.z}, d[3] = {path.r.d.x, path.r.d.y, path.r.d.z};
+    bounce.set(l, o, d);
+    paths[l] = path;
+    bounced |= 1u << l;
+  }
+  if (!bounced) return;
+
+  unsigned bounceHits = intersectPacket(scene.table, bounce, bounced, t, id);
+  for (int l = 0; l < n; l++)
+    if (bounceHits >> l & 1) out[l] = out[l] + radiance(scene, paths[l], rng[l], opts, t[l], id[l]);
+}
+
+Scene setupScene(double sphere1_x, double sphere1_y, double sphere1_z,
+                 double sphere2_x, double sphere2_y, double sphere2_z) {
+    Scene scene;
+    std::vector<Sphere> &spheres = scene.spheres;
+    spheres.reserve(9);
+
     // Scene walls (unchanged)
     spheres.emplace_back(1e5, Vec(1e5 + 1, 40.8, 81.6), Vec(), Vec(.75, .25, .25), DIFF); // Left
     spheres.emplace_back(1e5, Vec(-1e5 + 99, 40.8, 81.6), Vec(), Vec(.25, .25, .75), DIFF); // Right
@@ -134,113 +345,1810 @@ void setupScene(double sphere1_x, double sphere1_y, double sphere1_z,
     
     // Light (unchanged)
     spheres.emplace_back(600, Vec(50, 681.6 - .27, 81.6), Vec(12, 12, 12), Vec(), DIFF); // Light
+
+    // Only the cap poking .27 through the ceiling is visible from the room
+    const Sphere &light = spheres.back();
+    scene.lights.push_back({int(spheres.size()) - 1, Vec(0, -1, 0), (light.p.y - 81.6) / light.rad});
+
+    for (size_t i = 0; i < spheres.size(); i++)
+        scene.table.add(spheres[i].p.x, spheres[i].p.y, spheres[i].p.z, spheres[i].rad, int(i));
+    scene.table.finish();
+    return scene;
+}
+
+const int kImageW = 1024, kImageH = 768; // resolution of every frame
+
+// Timing of the last renderFrame() call, reported back to the client
+struct RenderStats {
+  double renderMs = 0;
+  int passes = 0;
+  double samplesMean = 0;    // samples per subpixel, averaged over the frame
+  double samplesResumed = 0; // of which were already in the stored frame
+  bool exact = false;        // the image is what a fresh render of the same options gives
+  int tiles = 0;
+  int tilesRemote = 0;       // of which other replicas rendered (distributed renders)
+  double tileMinMs = 0, tileMeanMs = 0, tileP95Ms = 0, tileMaxMs = 0;
+};
+
+// Interleaves the bits of x and y (x in the even bits)
+inline unsigned mortonKey(unsigned x, unsigned y) {
+  unsigned key = 0;
+  for (unsigned b = 0; b < 16; b++)
+    key |= ((x >> b) & 1u) << (2 * b) | ((y >> b) & 1u) << (2 * b + 1);
+  return key;
+}
+
+// Distance of (x, y) along the Hilbert curve filling an n x n grid, n a power of 2
+inline unsigned hilbertKey(unsigned n, unsigned x, unsigned y) {
+  unsigned d = 0;
+  for (unsigned s = n / 2; s > 0; s /= 2) {
+    unsigned rx = (x & s) > 0, ry = (y & s) > 0;
+    d += s * s * ((3 * rx) ^ ry);
+    if (ry == 0) { // rotate the quadrant
+      if (rx == 1) {
+        x = s - 1 - x;
+        y = s - 1 - y;
+      }
+      unsigned t = x;
+      x = y;
+      y = t;
+    }
+  }
+  return d;
+}
+
+struct Tile {
+  int x0, y0, x1, y1; // pixel bounds, exclusive upper
+};
+
+// Splits a w x h frame into size x size tiles listed in the requested order;
+// consecutive tiles stay spatially close so a worker's run shares cache lines
+std::vector<Tile> makeTiles(int w, int h, int size, TileOrder order) {
+  int tx = (w + size - 1) / size, ty = (h + size - 1) / size;
+  unsigned n = 1;
+  while (n < unsigned(std::max(tx, ty))) n *= 2;
+  std::vector<std::pair<unsigned, Tile>> keyed;
+  keyed.reserve(tx * ty);
+  for (int j = 0; j < ty; j++)
+    for (int i = 0; i < tx; i++) {
+      unsigned key = order == MORTON  ? mortonKey(i, j)
+                   : order == HILBERT ? hilbertKey(n, i, j)
+                                      : unsigned(j * tx + i);
+      keyed.push_back({key, Tile{i * size, j * size, std::min(w, (i + 1) * size), std::min(h, (j + 1) * size)}});
+    }
+  std::sort(keyed.begin(), keyed.end(),
+            [](const std::pair<unsigned, Tile> &a, const std::pair<unsigned, Tile> &b) { return a.first < b.first; });
+  std::vector<Tile> tiles;
+  tiles.reserve(keyed.size());
+  for (auto &k : keyed) tiles.push_back(k.second);
+  return tiles;
+}
+
+// Pinhole camera of the Cornell box scene
+struct Camera {
+  int w, h;
+  Vec o, d, cx, cy;
+  Camera(int w_, int h_) : w(w_), h(h_), o(50, 52, 295.6), d(Vec(0, -0.042612, -1).norm()) {
+    cx = Vec(w * .5135 / h);
+    cy = (cx % d).norm() * .5135;
+  }
+  // Ray through subpixel (sx, sy) of pixel (x, y), offset by tent-filtered
+  // uniform samples u1, u2
+  Ray ray(int x, int y, int sx, int sy, double u1, double u2) const {
+    double r1 = 2 * u1, dx = r1 < 1 ? sqrt(r1) - 1 : 1 - sqrt(2 - r1);
+    double r2 = 2 * u2, dy = r2 < 1 ? sqrt(r2) - 1 : 1 - sqrt(2 - r2);
+    Vec dir = cx * (((sx + .5 + dx) / 2 + x) / w - .5) + cy * (((sy + .5 + dy) / 2 + y) / h - .5) + d;
+    dir.norm();
+    return Ray(o + dir * 140, dir);
+  }
+};
+
+// Renders one tile with the recursive radiance(), packet= camera rays at a
+// time: pixel p of the tile takes its samples acc.count[p] to target[p]
+void renderTileRecursive(const Scene &scene, const Camera &cam, const RenderOptions &opts,
+                         const Sampler &sampler, const Tile &tile, const uint32_t *target,
+                         AccumBuffer &acc) {
+    int w = cam.w, packet = opts.packet;
+    for (int y = tile.y0; y < tile.y1; y++)
+        for (int x = tile.x0; x < tile.x1; x++) {
+            int p = y * w + x, s0 = int(acc.count[p]), s1 = int(target[p]);
+            if (s0 >= s1) continue;
+            for (int sy = 0; sy < 2; sy++)
+                for (int sx = 0; sx < 2; sx++) {
+                    for (int s = s0; s < s1; s += packet) {
+                        int lanes = std::min(packet, s1 - s);
+                        // Sample s of subpixel (sx, sy) is sample 4 * s + 2 * sy + sx of the pixel
+                        uint32_t pixel[RayPacket::kMax], sample[RayPacket::kMax];
+                        double u1[RayPacket::kMax], u2[RayPacket::kMax];
+                        Rng rng[RayPacket::kMax];
+                        for (int l = 0; l < lanes; l++) {
+                            pixel[l] = uint32_t(p);
+                            sample[l] = uint32_t(4 * (s + l) + 2 * sy + sx);
+                            rng[l] = Rng{pixel[l], sample[l], &sampler};
+                        }
+                        sampler.batch(pixel, sample, kDimFilterX, u1, lanes);
+                        sampler.batch(pixel, sample, kDimFilterY, u2, lanes);
+                        RayPacket camRays{};
+                        for (int l = 0; l < lanes; l++) {
+                            Ray ray = cam.ray(x, y, sx, sy, u1[l], u2[l]);
+                            if (packet == 1) {
+                                Vec li = radiance(scene, PathState{ray, Vec(1, 1, 1), 0}, rng[l], opts);
+                                acc.add(p, 2 * sy + sx, li.x, li.y, li.z);
+                                break;
+                            }
+                            const double o[3] = {ray.o.x, ray.o.y, ray.o.z}, dir[3] = {ray.d.x, ray.d.y, ray.d.z};
+                            camRays.set(l, o, dir);
+                        }
+                        if (packet == 1) continue;
+                        Vec li[RayPacket::kMax];
+                        radiancePacket(scene, camRays, lanes, rng, opts, li);
+                        for (int l = 0; l < lanes; l++) acc.add(p, 2 * sy + sx, li[l].x, li[l].y, li[l].z);
+                    }
+                }
+            acc.count[p] = uint32_t(s1);
+        }
 }
 
-bool renderToPNG(int samples, std::vector<unsigned char>& png_buffer) {
-    int w = 1024, h = 768, samps = samples;
-    Ray cam(Vec(50, 52, 295.6), Vec(0, -0.042612, -1).norm());
-    Vec cx = Vec(w * .5135 / h), cy = (cx % cam.d).norm() * .5135, r, *c = new Vec[w * h];
-
-    fprintf(stderr, "Rendering %dx%d with %d samples...\n", w, h, samps);
-
-    #pragma omp parallel for schedule(dynamic, 1) private(r)
-    for (int y = 0; y < h; y++) {
-        fprintf(stderr, "\rProgress: %5.2f%%", 100. * y / (h - 1));
-        for (unsigned short x = 0, Xi[3] = {0, 0, static_cast<unsigned short>(y * y * y)}; x < w; x++)
-            for (int sy = 0, i = (h - y - 1) * w + x; sy < 2; sy++)
-                for (int sx = 0; sx < 2; sx++, r = Vec()) {
-                    for (int s = 0; s < samps; s++) {
-                        double r1 = 2 * erand48(Xi), dx = r1 < 1 ? sqrt(r1) - 1 : 1 - sqrt(2 - r1);
-                        double r2 = 2 * erand48(Xi), dy = r2 < 1 ? sqrt(r2) - 1 : 1 - sqrt(2 - r2);
-                        Vec d = cx * (((sx + .5 + dx) / 2 + x) / w - .5) +
-                                cy * (((sy + .5 + dy) / 2 + y) / h - .5) + cam.d;
-                        r = r + radiance(Ray(cam.o + d * 140, d.norm()), 0, Xi) * (1. / samps);
+// Path states of one wavefront in structure-of-arrays form
+struct PathBuffer {
+  std::vector<double> ox, oy, oz, dx, dy, dz; // current ray
+  std::vector<double> tr, tg, tb;             // throughput
+  std::vector<double> pdf;                    // as PathState::pdf
+  std::vector<int> slot;                      // subpixel accumulator the path adds to
+  std::vector<int> depth;
+  std::vector<uint32_t> pixel, sample;        // Rng key of the path
+
+  void resize(size_t n) {
+    for (auto *v : {&ox, &oy, &oz, &dx, &dy, &dz, &tr, &tg, &tb, &pdf}) v->resize(n);
+    for (auto *v : {&pixel, &sample}) v->resize(n);
+    slot.resize(n);
+    depth.resize(n);
+  }
+};
+
+// Renders one tile with the wavefront integrator: one path per subpixel and
+// sample pass, advanced one bounce at a time in stages (intersect every live
+// path as packets, shade DIFF, SPEC and REFR hits in separate tight loops,
+// compact the survivors) until none are left. Glass never splits here; each
+// path picks reflection or refraction by Russian roulette. DIFF hits sample
+// the lights inline when opts.nee is set. Pass s covers sample
+// acc.count[p] + s of every pixel p still short of target[p].
+void renderTileWavefront(const Scene &scene, const Camera &cam, const RenderOptions &opts,
+                         const Sampler &sampler, const Tile &tile, const uint32_t *target,
+                         AccumBuffer &acc) {
+    int w = cam.w;
+    int tw = tile.x1 - tile.x0, th = tile.y1 - tile.y0, paths = tw * th * 4;
+
+    // Reused across tiles and requests by each worker
+    static thread_local PathBuffer cur, next;
+    static thread_local std::vector<double> hitT, u1, u2;
+    static thread_local std::vector<int> hitId, queue[3], slotPixel;
+    static thread_local std::vector<Vec> value;
+    cur.resize(paths);
+    next.resize(paths);
+    hitT.resize(paths);
+    u1.resize(paths);
+    u2.resize(paths);
+    hitId.resize(paths);
+    slotPixel.resize(paths / 4);
+
+    int passes = 0;
+    for (int y = tile.y0; y < tile.y1; y++)
+        for (int x = tile.x0; x < tile.x1; x++)
+            passes = std::max(passes, int(target[y * w + x]) - int(acc.count[y * w + x]));
+
+    for (int s = 0; s < passes; s++) {
+        // Generate: one camera path per subpixel of each unfinished pixel,
+        // keyed like the recursive engine
+        int live = 0;
+        for (int y = tile.y0; y < tile.y1; y++)
+            for (int x = tile.x0; x < tile.x1; x++) {
+                int p = y * w + x;
+                if (acc.count[p] + s >= target[p]) continue;
+                slotPixel[live / 4] = p;
+                for (int sub = 0; sub < 4; sub++, live++) {
+                    cur.pixel[live] = uint32_t(p);
+                    cur.sample[live] = 4 * (acc.count[p] + s) + sub;
+                }
+            }
+        int slots = live;
+        sampler.batch(cur.pixel.data(), cur.sample.data(), kDimFilterX, u1.data(), live);
+        sampler.batch(cur.pixel.data(), cur.sample.data(), kDimFilterY, u2.data(), live);
+        for (int k = 0; k < slots; k++) {
+            int p = slotPixel[k / 4], sub = k & 3;
+            Ray ray = cam.ray(p % w, p / w, sub & 1, sub >> 1, u1[k], u2[k]);
+            cur.ox[k] = ray.o.x, cur.oy[k] = ray.o.y, cur.oz[k] = ray.o.z;
+            cur.dx[k] = ray.d.x, cur.dy[k] = ray.d.y, cur.dz[k] = ray.d.z;
+            cur.tr[k] = cur.tg[k] = cur.tb[k] = 1;
+            cur.pdf[k] = 0;
+            cur.slot[k] = k;
+            cur.depth[k] = 0;
+        }
+        value.assign(slots, Vec());
+
+        while (live > 0) {
+            // Intersect: every live path, RayPacket::kMax at a time
+            for (auto &q : queue) q.clear();
+            for (int base = 0; base < live; base += RayPacket::kMax) {
+                int lanes = std::min(RayPacket::kMax, live - base);
+                RayPacket p{};
+                for (int l = 0; l < lanes; l++) {
+                    const double o[3] = {cur.ox[base + l], cur.oy[base + l], cur.oz[base + l]};
+                    const double d[3] = {cur.dx[base + l], cur.dy[base + l], cur.dz[base + l]};
+                    p.set(l, o, d);
+                }
+                unsigned hits = intersectPacket(scene.table, p, (1u << lanes) - 1, &hitT[base], &hitId[base]);
+                for (int l = 0; l < lanes; l++)
+                    if (hits >> l & 1) queue[scene.spheres[hitId[base + l]].refl].push_back(base + l);
+            }
+
+            // Shade: one material per loop; survivors are compacted into next
+            int survivors = 0;
+            for (int m = DIFF; m <= REFR; m++)
+                for (int i : queue[m]) {
+                    const Sphere &obj = scene.spheres[hitId[i]];
+                    Rng rng{cur.pixel[i], cur.sample[i], &sampler};
+                    int bounce = cur.depth[i];
+                    Vec o(cur.ox[i], cur.oy[i], cur.oz[i]), d(cur.dx[i], cur.dy[i], cur.dz[i]);
+                    Vec thr(cur.tr[i], cur.tg[i], cur.tb[i]);
+                    Vec x = o + d * hitT[i], n = (x - obj.p).norm(), nl = n.dot(d) < 0 ? n : n * -1, f = obj.c;
+                    double we = opts.nee ? emissionWeight(scene, hitId[i], o, x, cur.pdf[i]) : 1;
+                    value[cur.slot[i]] = value[cur.slot[i]] + thr.mult(obj.e) * we;
+
+                    int depth = cur.depth[i] + 1;
+                    double p = f.x > f.y && f.x > f.z ? f.x : f.y > f.z ? f.y : f.z; // max refl
+                    if (depth > 5) {
+                      if (rng(bounceDim(bounce, kDimRR)) < p) f = f * (1 / p);
+                      else continue; // R.R.
+                    }
+                    Vec nd;
+                    double pdf = 0;
+                    if (m == DIFF) {
+                        if (opts.nee) {
+                            const double u[3] = {rng(bounceDim(bounce, kDimLight)), rng(bounceDim(bounce, kDimLightU)),
+                                                 rng(bounceDim(bounce, kDimLightV))};
+                            value[cur.slot[i]] = value[cur.slot[i]] + thr.mult(f).mult(sampleLights(scene, x, nl, u));
+                        }
+                        double r1 = 2 * M_PI * rng(bounceDim(bounce, kDimBsdfU)), r2 = rng(bounceDim(bounce, kDimBsdfV)),
+                               r2s = sqrt(r2);
+                        Vec u = ((fabs(nl.x) > .1 ? Vec(0, 1) : Vec(1)) % nl).norm(), v = nl % u;
+                        nd = (u * cos(r1) * r2s + v * sin(r1) * r2s + nl * sqrt(1 - r2)).norm();
+                        pdf = nd.dot(nl) * M_1_PI;
+                    } else if (m == SPEC) {
+                        nd = d - n * 2 * n.dot(d);
+                    } else {
+                        nd = d - n * 2 * n.dot(d);
+                        bool into = n.dot(nl) > 0;
+                        double nc = 1, nt = 1.5, nnt = into ? nc / nt : nt / nc, ddn = d.dot(nl), cos2t;
+                        if ((cos2t = 1 - nnt * nnt * (1 - ddn * ddn)) >= 0) {
+                            Vec tdir = (d * nnt - n * ((into ? 1 : -1) * (ddn * nnt + sqrt(cos2t)))).norm();
+                            double a = nt - nc, b = nt + nc, R0 = a * a / (b * b),
+                                   cc = 1 - (into ? -ddn : tdir.dot(n));
+                            double Re = R0 + (1 - R0) * cc * cc * cc * cc * cc, Tr = 1 - Re, P = .25 + .5 * Re;
+                            if (rng(bounceDim(bounce, kDimGlass)) < P) {
+                                f = f * (Re / P);
+                            } else {
+                                f = f * (Tr / (1 - P));
+                                nd = tdir;
+                            }
+                        }
                     }
-                    c[i] = c[i] + Vec(clamp(r.x), clamp(r.y), clamp(r.z)) * .25;
+                    thr = thr.mult(f);
+                    if (thr.x == 0 && thr.y == 0 && thr.z == 0) continue; // nothing left to carry
+
+                    int k = survivors++;
+                    next.ox[k] = x.x, next.oy[k] = x.y, next.oz[k] = x.z;
+                    next.dx[k] = nd.x, next.dy[k] = nd.y, next.dz[k] = nd.z;
+                    next.tr[k] = thr.x, next.tg[k] = thr.y, next.tb[k] = thr.z;
+                    next.pdf[k] = pdf;
+                    next.slot[k] = cur.slot[i];
+                    next.depth[k] = depth;
+                    next.pixel[k] = cur.pixel[i];
+                    next.sample[k] = cur.sample[i];
                 }
+            std::swap(cur, next);
+            live = survivors;
+        }
+
+        // Accumulate: this pass's sample of every path's subpixel
+        for (int k = 0; k < slots; k++) acc.add(slotPixel[k / 4], k & 3, value[k].x, value[k].y, value[k].z);
+    }
+
+    for (int y = tile.y0; y < tile.y1; y++)
+        for (int x = tile.x0; x < tile.x1; x++)
+            acc.count[y * w + x] = std::max(acc.count[y * w + x], target[y * w + x]);
+}
+
+// Deadline mode: the share of budget_ms kept back for encoding and sending
+const double kDeadlineReserve = .1;
+
+// Plans the pass after the ones acc holds, `rendered` of its samples taken
+// since frameStart; see planAdaptivePass() for the contract. Against a
+// deadline, passes double the sample count while the throughput measured so
+// far says they still fit.
+bool planNextPass(const AccumBuffer &acc, const RenderOptions &opts, uint64_t rendered,
+                  std::chrono::steady_clock::time_point frameStart, std::vector<uint32_t> &target) {
+    uint64_t pixels = uint64_t(acc.w) * acc.h, limit = UINT64_MAX;
+    if (opts.budgetMs > 0) {
+        auto now = std::chrono::steady_clock::now();
+        double elapsedMs = std::chrono::duration<double, std::milli>(now - frameStart).count();
+        double leftMs = std::chrono::duration<double, std::milli>(opts.deadline - now).count() -
+                        opts.budgetMs * kDeadlineReserve;
+        if (leftMs <= 0) return false;
+        limit = rendered ? uint64_t(leftMs / std::max(elapsedMs, 1e-3) * rendered) : pixels;
+    }
+    if (opts.noise > 0) {
+        return planAdaptivePass(acc, uint32_t(opts.samples), uint32_t(opts.maxSamples), opts.noise, limit, target);
     }
-    fprintf(stderr, "\nRendering complete!\n");
+    if (opts.budgetMs <= 0) return false;
+
+    // Uniform passes raise every pixel to the same count; pixels a resumed
+    // frame already has beyond it keep their samples
+    uint32_t n = *std::min_element(acc.count.begin(), acc.count.end());
+    uint64_t k = std::min<uint64_t>({std::max(n, 1u), uint64_t(opts.samples) - std::min(n, uint32_t(opts.samples)),
+                                     limit / pixels});
+    if (k == 0) return false;
+    for (size_t p = 0; p < target.size(); p++) target[p] = std::max(acc.count[p], uint32_t(n + k));
+    return true;
+}
+
+// Fills in the min, mean, p95 and max of tileMs
+void tileTimes(std::vector<double> tileMs, RenderStats& st) {
+    if (tileMs.empty()) return;
+    std::sort(tileMs.begin(), tileMs.end());
+    st.tileMinMs = tileMs.front();
+    st.tileMaxMs = tileMs.back();
+    st.tileP95Ms = tileMs[std::min(tileMs.size() - 1, tileMs.size() * 95 / 100)];
+    for (double ms : tileMs) st.tileMeanMs += ms / tileMs.size();
+}
+
+enum ImageFormat { PNG, QOI, PPM, PAM, JPEG, HDR, FLOAT32 };
+
+// How a frame goes out: lossless PNG by default; QOI and the uncompressed
+// Netpbm formats for hops where encode time matters more than size, JPEG for
+// where size matters more than exactness. HDR and FLOAT32 carry the linear
+// radiance itself, unclamped and without gamma, for tone mapping downstream.
+struct Encoding {
+    ImageFormat format = PNG;
+    int pngLevel = png_encoder::kDefaultLevel; // 0-9
+    int jpegQuality = 90;                      // 1-100
+
+    const char* contentType() const {
+        switch (format) {
+        case QOI: return "image/qoi";
+        case PPM: return "image/x-portable-pixmap";
+        case PAM: return "image/x-portable-arbitrarymap";
+        case JPEG: return "image/jpeg";
+        case HDR: return "image/vnd.radiance";
+        case FLOAT32: return "application/octet-stream";
+        default: return "image/png";
+        }
+    }
+
+    // Everything that decides the encoded bytes, for cache keys
+    std::string key() const {
+        static const char* const kNames[] = {"png", "qoi", "ppm", "pam", "jpeg", "hdr", "float32"};
+        std::string key = kNames[format];
+        if (format == PNG) key += std::to_string(pngLevel);
+        if (format == JPEG) key += std::to_string(jpegQuality);
+        return key;
+    }
+
+    bool linear() const { return format == HDR || format == FLOAT32; }
+};
+
+// FLOAT32 output: "RF32", then width and height as uint32, then the RGB
+// floats row by row from the top, all little-endian
+const unsigned char kFloat32Magic[4] = {'R', 'F', '3', '2'};
 
-    // Convert to RGB
+// Writes the frame in acc as linear RGB floats, rows top to bottom: each
+// pixel the mean of its subpixels' means, unclamped
+void linearImage(RenderPool& pool, const AccumBuffer& acc, std::vector<float>& image) {
+    int w = acc.w, h = acc.h;
+    image.resize(size_t(w) * h * 3);
+    pool.parallelFor(h, [&](int y) {
+        for (int x = 0; x < w; x++) {
+            int p = y * w + x, i = (h - y - 1) * w + x;
+            double n = acc.count[p] ? 1. / acc.count[p] : 0, rgb[3] = {0, 0, 0};
+            for (int sub = 0; sub < 4; sub++)
+                for (int k = 0; k < 3; k++) rgb[k] += acc.sum[size_t(p) * 12 + sub * 3 + k] * n * .25;
+            for (int k = 0; k < 3; k++) image[size_t(i) * 3 + k] = float(rgb[k]);
+        }
+    });
+}
+
+// 8-bit RGB of pixel p of acc: each subpixel's mean clamped, then a 2x2 box
+void pixelRGB(const AccumBuffer& acc, int p, unsigned char* out) {
+    double n = acc.count[p] ? 1. / acc.count[p] : 0, rgb[3] = {0, 0, 0};
+    for (int sub = 0; sub < 4; sub++)
+        for (int k = 0; k < 3; k++) rgb[k] += clamp(acc.sum[size_t(p) * 12 + sub * 3 + k] * n) * .25;
+    for (int k = 0; k < 3; k++) out[k] = (unsigned char)toInt(rgb[k]);
+}
+
+// Encodes the frame in acc as enc asks, on pool
+bool encodeImage(RenderPool& pool, const AccumBuffer& acc, const Encoding& enc, std::vector<unsigned char>& out) {
+    int w = acc.w, h = acc.h;
+
+    if (enc.linear()) {
+        std::vector<float> image;
+        linearImage(pool, acc, image);
+        if (enc.format == HDR) {
+            // Radiance RGBE, run-length encoded by stb
+            out.clear();
+            auto append = [](void* context, void* data, int size) {
+                auto* bytes = static_cast<std::vector<unsigned char>*>(context);
+                bytes->insert(bytes->end(), static_cast<unsigned char*>(data),
+                              static_cast<unsigned char*>(data) + size);
+            };
+            if (!stbi_write_hdr_to_func(append, &out, w, h, 3, image.data())) out.clear();
+        } else {
+            out.assign(kFloat32Magic, kFloat32Magic + 4);
+            out.resize(12 + image.size() * 4);
+            auto put32 = [&](size_t at, uint32_t v) {
+                for (int b = 0; b < 4; b++) out[at + b] = (unsigned char)(v >> (8 * b));
+            };
+            put32(4, uint32_t(w));
+            put32(8, uint32_t(h));
+            pool.parallelFor(h, [&](int y) {
+                for (size_t k = size_t(y) * w * 3; k < size_t(y + 1) * w * 3; k++) {
+                    uint32_t bits;
+                    memcpy(&bits, &image[k], 4);
+                    put32(12 + k * 4, bits);
+                }
+            });
+        }
+        return !out.empty();
+    }
+
+    // Convert to RGB, rows from the top
     std::vector<unsigned char> image(w * h * 3);
-    for (int i = 0; i < w * h; i++) {
-        image[i * 3 + 0] = toInt(c[i].x);
-        image[i * 3 + 1] = toInt(c[i].y);
-        image[i * 3 + 2] = toInt(c[i].z);
+    pool.parallelFor(h, [&](int y) {
+        for (int x = 0; x < w; x++) pixelRGB(acc, y * w + x, &image[size_t((h - y - 1) * w + x) * 3]);
+    });
+
+    switch (enc.format) {
+    case QOI:
+        out = qoi_encoder::encode(image.data(), w, h);
+        break;
+    case PPM:
+    case PAM: {
+        char header[128];
+        int n = enc.format == PPM
+                    ? snprintf(header, sizeof(header), "P6\n%d %d\n255\n", w, h)
+                    : snprintf(header, sizeof(header), "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 3\nMAXVAL 255\nTUPLTYPE RGB\nENDHDR\n",
+                               w, h);
+        out.assign(header, header + n);
+        out.insert(out.end(), image.begin(), image.end());
+        break;
+    }
+    case JPEG: {
+        out.clear();
+        auto append = [](void* context, void* data, int size) {
+            auto* bytes = static_cast<std::vector<unsigned char>*>(context);
+            bytes->insert(bytes->end(), static_cast<unsigned char*>(data), static_cast<unsigned char*>(data) + size);
+        };
+        if (!stbi_write_jpg_to_func(append, &out, w, h, 3, image.data(), enc.jpegQuality)) out.clear();
+        break;
+    }
+    default:
+        // Filter and deflate bands of rows in parallel
+        out = png_encoder::encode(pool, image.data(), w, h, enc.pngLevel);
+    }
+    return !out.empty();
+}
+
+// Renders the frame into acc, continuing from the samples acc already holds
+// (an empty or differently sized acc starts afresh). onTile, if set, is
+// called with each tile as its worker finishes it, once per pass.
+void renderFrame(RenderPool& pool, const Scene& scene, const RenderOptions& opts, AccumBuffer& acc,
+                 RenderStats* stats = nullptr, const std::function<void(const Tile&)>& onTile = nullptr) {
+    int w = kImageW, h = kImageH, samps = opts.samples;
+    Camera cam(w, h);
+    Sampler sampler(opts.samplerKind, opts.seed, w);
+    if (acc.w != w || acc.h != h) acc = AccumBuffer(w, h);
+    uint64_t resumed = acc.totalSamples();
+    uint32_t resumedMax = *std::max_element(acc.count.begin(), acc.count.end());
+
+    std::vector<Tile> tiles = makeTiles(w, h, opts.tileSize, opts.order);
+    std::vector<double> tileMs(tiles.size());
+    bool adaptive = opts.noise > 0;
+    int first = adaptive ? std::min(samps, kAdaptiveFirst) : opts.budgetMs > 0 ? 1 : samps;
+    std::vector<uint32_t> target(size_t(w) * h);
+    bool pending = false;
+    for (int p = 0; p < w * h; p++) {
+        // A deadline always buys a resumed frame one more sample if it can
+        uint32_t n = acc.count[p];
+        target[p] = std::max(n, uint32_t(opts.budgetMs > 0 && n ? std::min(samps, int(n) + 1) : first));
+        pending |= target[p] > n;
+    }
+
+    fprintf(stderr, "Rendering %dx%d with %s%d samples%s in %zu tiles of %d (%s), %.1f resumed...\n",
+            w, h, opts.budgetMs > 0 ? "up to " : "", samps, adaptive ? " (adaptive)" : "",
+            tiles.size(), opts.tileSize, opts.engine == WAVEFRONT ? "wavefront" : "recursive",
+            double(resumed) / (w * h));
+    auto frameStart = std::chrono::steady_clock::now();
+
+    int passes = 0;
+    if (!pending) pending = planNextPass(acc, opts, 0, frameStart, target);
+    while (pending) {
+        // One pool item per tile; idle workers steal tiles from busy ones
+        std::atomic<int> tilesDone(0);
+        passes++;
+        pool.parallelFor(int(tiles.size()), [&](int t) {
+            auto tileStart = std::chrono::steady_clock::now();
+            if (opts.engine == WAVEFRONT) renderTileWavefront(scene, cam, opts, sampler, tiles[t], target.data(), acc);
+            else renderTileRecursive(scene, cam, opts, sampler, tiles[t], target.data(), acc);
+            tileMs[t] += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tileStart).count();
+            if (onTile) onTile(tiles[t]);
+            fprintf(stderr, "\rPass %d: %5.2f%%", passes, 100. * ++tilesDone / tiles.size());
+        });
+        pending = planNextPass(acc, opts, acc.totalSamples() - resumed, frameStart, target);
+    }
+
+    // Per-tile timings, for tuning the tile size
+    RenderStats st;
+    st.renderMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
+    st.passes = passes;
+    st.samplesMean = double(acc.totalSamples()) / (w * h);
+    st.samplesResumed = double(resumed) / (w * h);
+    // A resumed uniform frame is exact unless it had samples beyond samps
+    st.exact = opts.budgetMs <= 0 && (resumed == 0 || (!adaptive && resumedMax <= uint32_t(samps)));
+    st.tiles = int(tileMs.size());
+    tileTimes(tileMs, st);
+    fprintf(stderr, "\nRendering complete in %.0f ms, %d passes, %.1f samples/pixel "
+            "(tile ms: min %.2f, mean %.2f, p95 %.2f, max %.2f)\n",
+            st.renderMs, st.passes, st.samplesMean, st.tileMinMs, st.tileMeanMs, st.tileP95Ms, st.tileMaxMs);
+    if (stats) *stats = st;
+}
+
+
+// Exact renders never change for their parameters, so shared caches may keep
+// them; they still revalidate once a day in case the renderer changed
+const char* const kExactCacheControl = "public, max-age=86400";
+
+// Strong ETag of the response to cacheKey
+std::string etagOf(const std::string& cacheKey) {
+    char etag[24];
+    snprintf(etag, sizeof(etag), "\"%016llx\"", (unsigned long long)RenderCache::hash(cacheKey));
+    return etag;
+}
+
+// Whether an If-None-Match header value lists etag (or is *)
+bool etagMatches(const std::string& header, const std::string& etag) {
+    size_t pos = 0;
+    while (pos < header.size()) {
+        size_t end = header.find(',', pos);
+        if (end == std::string::npos) end = header.size();
+        size_t b = header.find_first_not_of(" \t", pos), e = header.find_last_not_of(" \t", end - 1);
+        if (b != std::string::npos && b < end) {
+            std::string tag = header.substr(b, e + 1 - b);
+            if (tag.compare(0, 2, "W/") == 0) tag.erase(0, 2); // If-None-Match compares weakly
+            if (tag == "*" || tag == etag) return true;
+        }
+        pos = end + 1;
+    }
+    return false;
+}
+
+// One /render request's parameters
+struct RenderRequest {
+    RenderOptions opts;
+    double sphere1_x = 27, sphere1_y = 16.5, sphere1_z = 47;    // Mirror sphere default
+    double sphere2_x = 73, sphere2_y = 16.5, sphere2_z = 78;    // Glass sphere default
+    bool cache = true;  // answer from, and add to, the render cache
+    bool resume = true; // continue, and keep, this scene's stored frame
+    bool distribute = false; // share the frame's tiles with worker replicas
+    Encoding encoding;
+
+    Scene scene() const {
+        return setupScene(sphere1_x, sphere1_y, sphere1_z, sphere2_x, sphere2_y, sphere2_z);
+    }
+
+    // Everything that decides a sample's value; packet width and tiling do not
+    std::string accumKey() const {
+        char key[512];
+        snprintf(key, sizeof(key), "%.17g,%.17g,%.17g,%.17g,%.17g,%.17g seed=%u sampler=%d engine=%d nee=%d split=%d",
+                 sphere1_x, sphere1_y, sphere1_z, sphere2_x, sphere2_y, sphere2_z, opts.seed,
+                 int(opts.samplerKind), int(opts.engine), int(opts.nee), opts.engine == RECURSIVE ? opts.split : -1);
+        return key;
+    }
+
+    // ...and everything else that decides the response body
+    std::string cacheKey() const {
+        char key[128];
+        snprintf(key, sizeof(key), " samples=%d noise=%.17g max_samples=%d %dx%d ", opts.samples,
+                 opts.noise, opts.noise > 0 ? opts.maxSamples : 0, kImageW, kImageH);
+        return accumKey() + key + encoding.key();
+    }
+
+    // Query string a replica renders the same samples from
+    std::string query() const {
+        static const char* const kSamplers[] = {"random", "sobol", "halton", "bluenoise"}; // by sampler::Kind
+        static const char* const kOrders[] = {"scanline", "morton", "hilbert"};
+        char q[512];
+        snprintf(q, sizeof(q),
+                 "samples=%d&s1x=%.17g&s1y=%.17g&s1z=%.17g&s2x=%.17g&s2y=%.17g&s2z=%.17g&engine=%s&packet=%d"
+                 "&split=%d&nee=%d&seed=%u&sampler=%s&tile=%d&order=%s",
+                 opts.samples, sphere1_x, sphere1_y, sphere1_z, sphere2_x, sphere2_y, sphere2_z,
+                 opts.engine == WAVEFRONT ? "wavefront" : "recursive", opts.packet, opts.split, int(opts.nee),
+                 opts.seed, kSamplers[opts.samplerKind], opts.tileSize, kOrders[opts.order]);
+        return q;
+    }
+};
+
+// Reads the sphere positions in params into r
+void parseSpheres(const crow::query_string& params, RenderRequest& r) {
+    // Parse sphere1 coordinates (mirror sphere)
+    if (params.get("s1x")) r.sphere1_x = atof(params.get("s1x"));
+    if (params.get("s1y")) r.sphere1_y = atof(params.get("s1y"));
+    if (params.get("s1z")) r.sphere1_z = atof(params.get("s1z"));
+
+    // Parse sphere2 coordinates (glass sphere)
+    if (params.get("s2x")) r.sphere2_x = atof(params.get("s2x"));
+    if (params.get("s2y")) r.sphere2_y = atof(params.get("s2y"));
+    if (params.get("s2z")) r.sphere2_z = atof(params.get("s2z"));
+
+    // Clamp coordinates to reasonable scene bounds
+    r.sphere1_x = std::max(20.0, std::min(80.0, r.sphere1_x));
+    r.sphere1_y = std::max(16.5, std::min(65.0, r.sphere1_y));
+    r.sphere1_z = std::max(30.0, std::min(120.0, r.sphere1_z));
+
+    r.sphere2_x = std::max(20.0, std::min(80.0, r.sphere2_x));
+    r.sphere2_y = std::max(16.5, std::min(65.0, r.sphere2_y));
+    r.sphere2_z = std::max(30.0, std::min(120.0, r.sphere2_z));
+}
+
+// Reads the output format parameters in params into enc. Returns the message
+// of a 400 for an invalid one, else "".
+std::string parseEncoding(const crow::query_string& params, Encoding& enc) {
+    if (const char* format = params.get("format")) {
+        if (!strcmp(format, "png")) enc.format = PNG;
+        else if (!strcmp(format, "qoi")) enc.format = QOI;
+        else if (!strcmp(format, "ppm")) enc.format = PPM;
+        else if (!strcmp(format, "pam")) enc.format = PAM;
+        else if (!strcmp(format, "jpeg") || !strcmp(format, "jpg")) enc.format = JPEG;
+        else if (!strcmp(format, "hdr")) enc.format = HDR;
+        else if (!strcmp(format, "float32")) enc.format = FLOAT32;
+        else {
+            return "format must be one of png, qoi, ppm, pam, jpeg, hdr, float32";
+        }
+    }
+    if (params.get("png_level")) {
+        enc.pngLevel = std::max(0, std::min(9, atoi(params.get("png_level"))));
+    }
+    if (params.get("quality")) {
+        enc.jpegQuality = std::max(1, std::min(100, atoi(params.get("quality"))));
+    }
+    return "";
+}
+
+// Reads /render's parameters into r. Returns the message of a 400 for an
+// invalid one, else "".
+std::string parseRenderRequest(const crow::query_string& params, RenderRequest& r) {
+    RenderOptions &opts = r.opts;
+    int &samples = opts.samples;
+
+    // Parse samples parameter
+    if (params.get("samples")) {
+        samples = std::max(1, std::min(1000, atoi(params.get("samples"))));
+    }
+
+    // Parse render deadline; samples, if given, still caps the count
+    if (params.get("budget_ms")) {
+        opts.budgetMs = std::max(1, std::min(3600000, atoi(params.get("budget_ms"))));
+        opts.deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(opts.budgetMs);
+        if (!params.get("samples")) samples = 1000;
+    }
+
+    // Parse adaptive sampling: samples becomes the frame's average budget
+    if (params.get("noise")) {
+        opts.noise = std::max(0.0, atof(params.get("noise")));
+    }
+    opts.maxSamples = std::min(4000, 4 * samples);
+    if (params.get("max_samples")) {
+        opts.maxSamples = std::max(samples, std::min(4000, atoi(params.get("max_samples"))));
+    }
+
+    // Parse packet width for camera rays
+    if (const char* packet = params.get("packet")) {
+        opts.packet = atoi(packet);
+        if (opts.packet != 1 && opts.packet != 4 && opts.packet != 8 && opts.packet != 16) {
+            return "packet must be 1, 4, 8 or 16";
+        }
+    }
+
+    // Parse glass splitting depth
+    if (params.get("split")) {
+        opts.split = std::max(0, std::min(kMaxSplit, atoi(params.get("split"))));
     }
 
-    // Convert to PNG in memory
-    int out_len = 0;
-    unsigned char* out_png = stbi_write_png_to_mem(
-        image.data(), w * 3, w, h, 3, &out_len
-    );
+    // Parse light sampling switch
+    if (params.get("nee")) {
+        opts.nee = atoi(params.get("nee")) != 0;
+    }
+
+    // Parse random seed
+    if (params.get("seed")) {
+        opts.seed = uint32_t(strtoul(params.get("seed"), nullptr, 10));
+    }
+
+    // Parse sample generator
+    if (const char* kind = params.get("sampler")) {
+        if (!strcmp(kind, "sobol")) opts.samplerKind = sampler::SOBOL;
+        else if (!strcmp(kind, "halton")) opts.samplerKind = sampler::HALTON;
+        else if (!strcmp(kind, "bluenoise")) opts.samplerKind = sampler::BLUE_NOISE;
+        else if (!strcmp(kind, "random")) opts.samplerKind = sampler::RANDOM;
+        else {
+            return "sampler must be one of sobol, halton, bluenoise, random";
+        }
+    }
+
+    // Parse whether to answer from, and add to, the render cache
+    if (params.get("cache")) {
+        r.cache = atoi(params.get("cache")) != 0;
+    }
+
+    // Parse whether to continue, and keep, this scene's stored frame
+    if (params.get("resume")) {
+        r.resume = atoi(params.get("resume")) != 0;
+    }
+
+    // Parse whether to share the frame's tiles with worker replicas
+    if (params.get("distribute")) {
+        r.distribute = atoi(params.get("distribute")) != 0;
+    }
+
+    std::string error = parseEncoding(params, r.encoding);
+    if (!error.empty()) return error;
+
+    // Parse integrator choice
+    if (const char* engine = params.get("engine")) {
+        if (!strcmp(engine, "wavefront")) opts.engine = WAVEFRONT;
+        else if (!strcmp(engine, "recursive")) opts.engine = RECURSIVE;
+        else {
+            return "engine must be recursive or wavefront";
+        }
+    }
+
+    // Parse tile scheduling parameters
+    if (params.get("tile")) {
+        opts.tileSize = std::max(4, std::min(256, atoi(params.get("tile"))));
+    }
+    if (const char* order = params.get("order")) {
+        if (!strcmp(order, "scanline")) opts.order = SCANLINE;
+        else if (!strcmp(order, "hilbert")) opts.order = HILBERT;
+        else if (!strcmp(order, "morton")) opts.order = MORTON;
+        else {
+            return "order must be one of morton, hilbert, scanline";
+        }
+    }
+
+    if (r.distribute && (opts.budgetMs > 0 || opts.noise > 0)) {
+        return "distribute renders a fixed sample count, without budget_ms or noise";
+    }
+
+    parseSpheres(params, r);
+    return "";
+}
+
+// A frame rendered across replicas: the coordinator's buffer and the tiles
+// workers lease by index
+struct DistributedFrame {
+    AccumBuffer acc;
+    std::vector<Tile> tiles;
+};
+
+using Coordinator = TileCoordinator<DistributedFrame>;
+
+// A frame rendered across replicas, from the pool job that renders our tiles
+// of it until distributedLoop hands the finished frame to done
+struct DistributedRender {
+    DistributedRender(const Scene& scene_, const RenderRequest& r_)
+        : r(r_), scene(scene_), cam(kImageW, kImageH), sampler(r_.opts.samplerKind, r_.opts.seed, kImageW),
+          frame{AccumBuffer(kImageW, kImageH), makeTiles(kImageW, kImageH, r_.opts.tileSize, r_.opts.order)},
+          local(kImageW, kImageH), target(size_t(kImageW) * kImageH, uint32_t(r_.opts.samples)) {}
+
+    RenderRequest r;
+    Scene scene;
+    Camera cam;
+    Sampler sampler;
+    DistributedFrame frame;
+    AccumBuffer local; // our own tiles, copied over like a worker's
+    std::vector<uint32_t> target;
+    std::vector<double> tileMs;
+    std::mutex tileMsMutex;
+    std::atomic<int> tilesLocal{0};
+    std::atomic<bool> localQueued{false}; // a pool job is on its expired tiles
+    uint64_t job = 0;
+    std::chrono::steady_clock::time_point start;
+    // Called on the pool with the frame once every tile is back (ok) or one
+    // of them failed
+    std::function<void(bool ok, AccumBuffer& acc, const RenderStats& stats)> done;
+    // distributedLoop's own
+    bool finished = false, ok = false;
+    RenderStats stats;
+};
+
+// Distributed renders waiting for worker replicas, finished by distributedLoop
+struct DistributedRenders {
+    std::mutex m;
+    std::vector<std::shared_ptr<DistributedRender>> renders;
+};
+
+// Renders the tiles of d nobody has leased on every worker of pool, from a
+// pool job
+void renderLocalTiles(RenderPool& pool, Coordinator& coordinator, DistributedRender& d) {
+    const RenderOptions& opts = d.r.opts;
+    pool.parallelFor(int(pool.stats().workers), [&](int) {
+        Coordinator::Lease lease;
+        while (coordinator.leaseLocal(d.job, lease)) {
+            const Tile& tile = d.frame.tiles[lease.tile];
+            auto tileStart = std::chrono::steady_clock::now();
+            if (opts.engine == WAVEFRONT) {
+                renderTileWavefront(d.scene, d.cam, opts, d.sampler, tile, d.target.data(), d.local);
+            } else {
+                renderTileRecursive(d.scene, d.cam, opts, d.sampler, tile, d.target.data(), d.local);
+            }
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tileStart).count();
+            {
+                std::lock_guard<std::mutex> lk(d.tileMsMutex);
+                d.tileMs.push_back(ms);
+            }
+            // Counted as it is applied, before distributedLoop can see the frame done
+            std::string packed = d.local.pack(tile.x0, tile.y0, tile.x1, tile.y1);
+            coordinator.complete(d.job, lease.tile, true, [&](DistributedFrame& f, int t) {
+                if (!f.acc.unpack(packed, f.tiles[t].x0, f.tiles[t].y0, f.tiles[t].x1, f.tiles[t].y1)) return false;
+                d.tilesLocal++;
+                return true;
+            });
+        }
+    });
+}
+
+// Starts rendering the frame r describes from scratch, its tiles shared
+// between pool and every worker replica leasing them from coordinator. Called
+// from a pool job, which renders our tiles and returns once none are left
+// instead of waiting for the remote ones; distributedLoop then calls done.
+void startDistributed(RenderPool& pool, Coordinator& coordinator, DistributedRenders& renders, const Scene& scene,
+                      const RenderRequest& r,
+                      std::function<void(bool ok, AccumBuffer& acc, const RenderStats& stats)> done) {
+    auto d = std::make_shared<DistributedRender>(scene, r);
+    d->done = std::move(done);
+    fprintf(stderr, "Rendering %dx%d with %d samples in %zu tiles of %d (%s), distributed...\n", kImageW, kImageH,
+            r.opts.samples, d->frame.tiles.size(), r.opts.tileSize,
+            r.opts.engine == WAVEFRONT ? "wavefront" : "recursive");
+    d->start = std::chrono::steady_clock::now();
+    d->job = coordinator.start(r.query(), int(d->frame.tiles.size()), &d->frame);
+    try {
+        renderLocalTiles(pool, coordinator, *d);
+    } catch (...) {
+        coordinator.finish(d->job);
+        throw;
+    }
+    std::lock_guard<std::mutex> lk(renders.m);
+    renders.renders.push_back(d);
+}
+
+// Finishes the distributed renders in renders without holding a pool job
+// while they wait: sends the pool after tiles whose lease ran out, and hands
+// each frame whose tiles are all back (or one failed) to a pool job calling
+// its done. Runs until stop is set.
+void distributedLoop(RenderPool& pool, Coordinator& coordinator, DistributedRenders& renders,
+                     const std::atomic<bool>& stop) {
+    while (!stop) {
+        coordinator.waitAny(std::chrono::milliseconds(100));
+        std::vector<std::shared_ptr<DistributedRender>> waiting;
+        {
+            std::lock_guard<std::mutex> lk(renders.m);
+            waiting = renders.renders;
+        }
+        for (const std::shared_ptr<DistributedRender>& d : waiting) {
+            if (!d->finished) {
+                int state = coordinator.wait(d->job, std::chrono::milliseconds(0));
+                if (state == 0) {
+                    if (coordinator.pending(d->job) > 0 && !d->localQueued.exchange(true)) {
+                        bool queued = pool.submit([&pool, &coordinator, d](double) {
+                            try {
+                                renderLocalTiles(pool, coordinator, *d);
+                            } catch (const std::exception& e) {
+                                fprintf(stderr, "Rendering distributed tiles failed: %s\n", e.what());
+                            }
+                            d->localQueued = false;
+                        });
+                        if (!queued) d->localQueued = false; // tried again next round
+                    }
+                    continue;
+                }
+                coordinator.finish(d->job); // no result touches the frame after this
+                d->finished = true;
+                d->ok = state > 0;
+
+                RenderStats& st = d->stats;
+                st.renderMs =
+                    std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - d->start).count();
+                st.passes = 1;
+                st.samplesMean = double(d->frame.acc.totalSamples()) / (kImageW * kImageH);
+                st.exact = d->ok;
+                st.tiles = int(d->frame.tiles.size());
+                st.tilesRemote = st.tiles - d->tilesLocal;
+                {
+                    std::lock_guard<std::mutex> lk(d->tileMsMutex);
+                    tileTimes(d->tileMs, st); // ours only
+                }
+                fprintf(stderr, "Distributed render %s in %.0f ms, %d of %d tiles remote\n",
+                        d->ok ? "complete" : "failed", st.renderMs, st.tilesRemote, st.tiles);
+            }
+
+            // A full queue keeps the frame here until the next round
+            if (!pool.submit([d](double) { d->done(d->ok, d->frame.acc, d->stats); })) continue;
+            std::lock_guard<std::mutex> lk(renders.m);
+            renders.renders.erase(std::find(renders.renders.begin(), renders.renders.end(), d));
+        }
+    }
+}
+
+// Worker side of distributed renders: leases tiles from the coordinator at
+// url, as many at a time as pool has workers and room in its queue, renders
+// each as a pool job and posts it back, until stop is set
+void tileWorkerLoop(RenderPool& pool, http_client::Url url, const std::atomic<bool>& stop) {
+    AccumBuffer acc(kImageW, kImageH);
+    std::string spec;
+    RenderRequest r;
+    while (!stop) {
+        RenderPool::Stats poolStats = pool.stats();
+        size_t room = poolStats.capacity - std::min(poolStats.capacity, poolStats.queued);
+        int batch = int(std::min<size_t>(poolStats.workers, room));
+        if (batch == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+        http_client::Response res;
+        if (!http_client::request(url, "GET", "/tiles/lease?count=" + std::to_string(batch), "", res, 10000) ||
+            res.status != 200) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(res.status == 204 ? 100 : 1000));
+            continue;
+        }
+
+        // One "<job> <tile> <spec>" line per lease, all of one job
+        std::vector<std::pair<unsigned long long, int>> leases;
+        std::istringstream lines(res.body);
+        std::string line;
+        while (std::getline(lines, line)) {
+            unsigned long long job = 0;
+            int tile = -1;
+            char leaseSpec[1024];
+            if (sscanf(line.c_str(), "%llu %d %1023s", &job, &tile, leaseSpec) != 3) continue;
+            if (leaseSpec != spec) {
+                RenderRequest parsed;
+                if (!parseRenderRequest(crow::query_string("?" + std::string(leaseSpec)), parsed).empty()) continue;
+                spec = leaseSpec;
+                r = parsed;
+            }
+            leases.push_back({job, tile});
+        }
+        if (leases.empty()) continue;
+
+        // Each tile is a job of its own, queued and counted like any render;
+        // they are disjoint tiles of one frame, so they share acc
+        Scene scene = r.scene();
+        Camera cam(kImageW, kImageH);
+        Sampler sampler(r.opts.samplerKind, r.opts.seed, kImageW);
+        std::vector<Tile> tiles = makeTiles(kImageW, kImageH, r.opts.tileSize, r.opts.order);
+        std::vector<uint32_t> target(size_t(kImageW) * kImageH, uint32_t(r.opts.samples));
+        std::mutex m;
+        std::condition_variable cv;
+        size_t running = 0;
+        for (const auto& lease : leases) {
+            if (lease.second < 0 || lease.second >= int(tiles.size())) continue;
+            {
+                std::lock_guard<std::mutex> lk(m);
+                running++;
+            }
+            bool queued = pool.submit([&, lease](double) {
+                const Tile& tile = tiles[lease.second];
+                try {
+                    acc.clearRect(tile.x0, tile.y0, tile.x1, tile.y1);
+                    if (r.opts.engine == WAVEFRONT) {
+                        renderTileWavefront(scene, cam, r.opts, sampler, tile, target.data(), acc);
+                    } else {
+                        renderTileRecursive(scene, cam, r.opts, sampler, tile, target.data(), acc);
+                    }
+                    // An undelivered tile is leased again once its lease runs out
+                    http_client::Response ack;
+                    http_client::request(url, "POST",
+                                         "/tiles/result?job=" + std::to_string(lease.first) +
+                                             "&tile=" + std::to_string(lease.second),
+                                         acc.pack(tile.x0, tile.y0, tile.x1, tile.y1), ack, 10000);
+                } catch (const std::exception& e) {
+                    fprintf(stderr, "Rendering leased tile failed: %s\n", e.what());
+                }
+                std::lock_guard<std::mutex> lk(m);
+                if (--running == 0) cv.notify_all();
+            });
+            if (!queued) {
+                // The rest are leased again once their leases run out
+                std::lock_guard<std::mutex> lk(m);
+                running--;
+                break;
+            }
+        }
+        std::unique_lock<std::mutex> lk(m);
+        cv.wait(lk, [&] { return running == 0; });
+    }
+}
+
+// Encodes acc as r asks into image, putting an exact result in cache and disk,
+// each when given
+bool encodeResult(RenderPool& pool, const AccumBuffer& acc, const RenderRequest& r, const RenderStats& stats,
+                  RenderCache* cache, DiskCache* disk, std::vector<unsigned char>& image) {
+    if (!encodeImage(pool, acc, r.encoding, image)) return false;
+    if (cache && stats.exact) {
+        std::string cacheKey = r.cacheKey();
+        auto bytes = std::make_shared<const std::string>(image.begin(), image.end());
+        cache->put(cacheKey, bytes);
+        if (disk) disk->put(cacheKey, *bytes);
+    }
+    return true;
+}
+
+// Renders scene with r's options on pool, continuing r's stored frame in
+// store and putting an exact result in cache and disk, each when given.
+// Distributed renders go through startDistributed() instead.
+bool renderRequest(RenderPool& pool, const Scene& scene, const RenderRequest& r, AccumStore* store,
+                   RenderCache* cache, DiskCache* disk, std::vector<unsigned char>& image, RenderStats& stats) {
+    std::string accumKey = r.accumKey();
+    std::unique_ptr<AccumBuffer> acc = store ? store->take(accumKey) : nullptr;
+    if (!acc) acc.reset(new AccumBuffer);
+    renderFrame(pool, scene, r.opts, *acc, &stats);
+    bool ok = encodeResult(pool, *acc, r, stats, cache, disk, image);
+    if (ok && store) store->put(accumKey, std::move(acc));
+    return ok;
+}
+
+const int kMaxSweepFrames = 256;
+const char* const kSweepBoundary = "render-sweep-frame";
+
+// Expands a /render/sweep request into its frames, each base with its own
+// sphere positions: param stepped from `from` to `to`, or one line of sphere
+// parameters per frame in a POST body. Returns the message of a 400, or "".
+std::string parseSweep(const crow::request& req, const RenderRequest& base, std::vector<RenderRequest>& frames) {
+    static const char* const kParams[] = {"s1x", "s1y", "s1z", "s2x", "s2y", "s2z"};
+    if (req.method == crow::HTTPMethod::POST) {
+        std::istringstream lines(req.body);
+        std::string line;
+        while (std::getline(lines, line)) {
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            if (line.empty()) continue;
+            if (line[0] != '?') line = "?" + line;
+            frames.push_back(base);
+            parseSpheres(crow::query_string(line), frames.back());
+            if (frames.size() > size_t(kMaxSweepFrames)) break;
+        }
+    } else {
+        const char* param = req.url_params.get("param");
+        int which = -1;
+        for (int i = 0; param && i < 6; i++) {
+            if (!strcmp(param, kParams[i])) which = i;
+        }
+        if (which < 0) return "param must be one of s1x, s1y, s1z, s2x, s2y, s2z";
+        if (!req.url_params.get("from") || !req.url_params.get("to")) return "from and to are required";
+        double from = atof(req.url_params.get("from")), to = atof(req.url_params.get("to"));
+        double step = req.url_params.get("step") ? atof(req.url_params.get("step")) : 1;
+        if (!(step != 0) || (to - from) / step < 0) return "step must be nonzero and lead from `from` to `to`";
+        double count = floor((to - from) / step + 1e-9) + 1;
+        for (int i = 0; i < count && i <= kMaxSweepFrames; i++) {
+            frames.push_back(base);
+            char value[32];
+            snprintf(value, sizeof(value), "?%s=%.17g", kParams[which], from + i * step);
+            parseSpheres(crow::query_string(value), frames.back());
+        }
+    }
+    if (frames.empty()) return "no frames to render";
+    if (frames.size() > size_t(kMaxSweepFrames)) return "at most " + std::to_string(kMaxSweepFrames) + " frames";
+    return "";
+}
+
+// Names what a packed sample range was rendered with, so only ranges of the
+// same frame are merged
+uint32_t sampleRangeTag(const RenderRequest& r) {
+    return uint32_t(RenderCache::hash(r.accumKey()));
+}
+
+// Sample-parallel renders: samples first to first + samples - 1 of every
+// subpixel of the frame r describes, packed whole (see AccumBuffer)
+std::string renderSampleRange(RenderPool& pool, const Scene& scene, const RenderRequest& r, uint32_t first,
+                              RenderStats& stats) {
+    RenderOptions opts = r.opts;
+    opts.samples = int(first) + r.opts.samples;
+    AccumBuffer acc(kImageW, kImageH);
+    std::fill(acc.count.begin(), acc.count.end(), first); // pixels continue from sample `first`
+    renderFrame(pool, scene, opts, acc, &stats);
+    for (uint32_t& n : acc.count) n -= first;
+    return acc.pack(0, 0, acc.w, acc.h, first, sampleRangeTag(r));
+}
+
+// Adds up the packed sample ranges concatenated in data into acc. Returns the
+// message of a 400, or "" and whether the ranges run from sample 0 without
+// gaps, which makes acc the frame a single render of them all gives.
+std::string mergeSampleRanges(const std::string& data, AccumBuffer& acc, bool& contiguous) {
+    size_t frameBytes = AccumBuffer::packedBytes(acc.w, acc.h);
+    if (data.empty() || data.size() % frameBytes != 0) {
+        return "body must be whole packed " + std::to_string(acc.w) + "x" + std::to_string(acc.h) + " frames";
+    }
+    std::vector<std::pair<uint32_t, uint32_t>> ranges; // first, samples of pixel 0
+    uint32_t tag0 = 0;
+    for (size_t offset = 0; offset < data.size(); offset += frameBytes) {
+        uint32_t first, tag, before = acc.count[0];
+        if (!acc.addPacked(data.substr(offset, frameBytes), first, tag)) {
+            return "frame " + std::to_string(ranges.size()) + " is not a packed sample range";
+        }
+        if (ranges.empty()) tag0 = tag;
+        if (tag != tag0) return "frame " + std::to_string(ranges.size()) + " renders other options or another scene";
+        ranges.push_back({first, acc.count[0] - before});
+    }
+    std::sort(ranges.begin(), ranges.end());
+    uint32_t next = 0;
+    contiguous = true;
+    for (const auto& range : ranges) {
+        if (range.first < next) return "sample ranges overlap";
+        contiguous &= range.first == next;
+        next = range.first + range.second;
+    }
+    return "";
+}
+
+// /render/stream sends a frame as a run of records, each a 4-byte kind, a
+// uint32 payload length and the payload, integers little-endian
+std::string streamRecord(const char* kind, const std::string& payload) {
+    std::string out(kind, 4);
+    for (int b = 0; b < 4; b++) out += char(uint32_t(payload.size()) >> (8 * b));
+    return out + payload;
+}
+
+std::string streamWords(std::initializer_list<uint32_t> words) {
+    std::string out;
+    for (uint32_t v : words)
+        for (int b = 0; b < 4; b++) out += char(v >> (8 * b));
+    return out;
+}
+
+// "TILE": x, y (from the top), width and height, then its 8-bit RGB rows
+// from the top
+std::string tileRecord(const AccumBuffer& acc, const Tile& t) {
+    int tw = t.x1 - t.x0, th = t.y1 - t.y0;
+    std::string payload = streamWords({uint32_t(t.x0), uint32_t(acc.h - t.y1), uint32_t(tw), uint32_t(th)});
+    size_t at = payload.size();
+    payload.resize(at + size_t(tw) * th * 3);
+    for (int y = t.y1 - 1; y >= t.y0; y--)
+        for (int x = t.x0; x < t.x1; x++, at += 3) pixelRGB(acc, y * acc.w + x, (unsigned char*)&payload[at]);
+    return streamRecord("TILE", payload);
+}
+
+// An interactive /session: the options its client sent last and the frame
+// refining them. Refinement runs as one pool job per pass, at most one at a
+// time, so sessions share the pool with every other render between passes.
+struct Session {
+    std::mutex m;
+    crow::websocket::connection* conn; // null once the client is gone
+    RenderRequest request;
+    uint32_t update = 0; // updates received, echoed with each frame
+    int fps = 10;        // frames per second to aim for
+    bool rendering = false; // a pass is queued or running
 
-    bool success = false;
-    if (out_png && out_len > 0) {
-        png_buffer.assign(out_png, out_png + out_len);
-        STBIW_FREE(out_png);
-        success = true;
+    // Only touched by the pass running, never under m
+    AccumBuffer acc;       // reused across updates
+    RenderRequest current; // the update acc holds samples of...
+    uint32_t currentUpdate = 0; // ...and its number
+    Scene scene;
+    int done = 0; // samples per pixel in acc
+    double msPerSample = 0;
+};
+
+// Reads one session update, a /render query string (without budget_ms, noise
+// or distribute) plus fps, into r and fps. Returns the error, else "".
+std::string parseSessionUpdate(const std::string& message, RenderRequest& r, int& fps) {
+    crow::query_string params("?" + message);
+    r.encoding.format = JPEG; // frames are previews unless the client asks otherwise
+    std::string error = parseRenderRequest(params, r);
+    if (error.empty() && (r.opts.budgetMs > 0 || r.opts.noise > 0 || r.distribute)) {
+        error = "sessions refine up to samples, without budget_ms, noise or distribute";
     }
+    if (params.get("fps")) fps = std::max(1, std::min(60, atoi(params.get("fps"))));
+    return error;
+}
 
-    delete[] c;
-    return success;
+void refinePass(RenderPool& pool, std::shared_ptr<Session> session);
+
+// Queues session's next pass; on a full pool refinement pauses until the
+// client's next update
+void queueSessionPass(RenderPool& pool, std::shared_ptr<Session> session) {
+    if (pool.submit([&pool, session](double) { refinePass(pool, session); })) return;
+    std::lock_guard<std::mutex> lk(session->m);
+    session->rendering = false;
+    if (session->conn) session->conn->send_text("error: Render queue full");
 }
 
+// One pass of a session: renders about a frame interval's worth of samples
+// (one sample first, for an immediate frame) and sends the image, then
+// queues the next pass until the frame has samples per pixel. An update
+// starts over in the same buffer. Frames of an outdated update are dropped,
+// and so is every frame but the last while the client is still receiving
+// the one before.
+void refinePass(RenderPool& pool, std::shared_ptr<Session> session) {
+    Session& s = *session;
+    int fps;
+    {
+        std::lock_guard<std::mutex> lk(s.m);
+        if (!s.conn) {
+            s.rendering = false;
+            return;
+        }
+        if (s.update != s.currentUpdate) {
+            s.currentUpdate = s.update;
+            s.current = s.request;
+            s.scene = s.current.scene();
+            if (s.acc.w != kImageW || s.acc.h != kImageH) s.acc = AccumBuffer(kImageW, kImageH);
+            else s.acc.clearRect(0, 0, s.acc.w, s.acc.h);
+            s.done = 0;
+        }
+        fps = s.fps;
+    }
+
+    RenderOptions opts = s.current.opts;
+    int more = s.done == 0 ? 1 : s.msPerSample > 0 ? int(1000. / fps / s.msPerSample) : 1;
+    opts.samples = std::min(s.current.opts.samples, s.done + std::max(1, more));
+    RenderStats stats;
+    renderFrame(pool, s.scene, opts, s.acc, &stats);
+    s.msPerSample = stats.renderMs / (opts.samples - s.done);
+    s.done = opts.samples;
+    bool last = s.done >= s.current.opts.samples;
+
+    bool send;
+    {
+        std::lock_guard<std::mutex> lk(s.m);
+        if (!s.conn) {
+            s.rendering = false;
+            return;
+        }
+        send = s.update == s.currentUpdate && (last || s.conn->buffered_amount() == 0);
+    }
+    std::vector<unsigned char> image;
+    bool ok = send && encodeImage(pool, s.acc, s.current.encoding, image);
+    {
+        std::lock_guard<std::mutex> lk(s.m);
+        if (!s.conn) {
+            s.rendering = false;
+            return;
+        }
+        if (send && s.update == s.currentUpdate) {
+            if (ok) {
+                std::string frame = streamWords({s.currentUpdate, uint32_t(s.done)});
+                frame.append(image.begin(), image.end());
+                s.conn->send_binary(std::move(frame));
+            } else {
+                s.conn->send_text("error: Encoding failed");
+            }
+        }
+        if (last && s.update == s.currentUpdate) {
+            s.rendering = false;
+            return;
+        }
+    }
+    queueSessionPass(pool, session);
+}
+
+// A client waiting for a render: its response and the I/O thread that owns it
+struct RenderWaiter {
+    crow::response* res;
+    crow::asio::io_context* io;
+};
+
 int main() {
     crow::SimpleApp app;
 
+    // Every render runs on this pool; handlers only queue work and return
+    std::unique_ptr<RenderPool> pool(RenderPool::fromEnv());
+
+    // Tiles of distributed renders, leased by worker replicas
+    std::unique_ptr<Coordinator> tileCoordinator(Coordinator::fromEnv());
+
+    // ...and the renders waiting for them, finished without holding a pool job
+    DistributedRenders distributing;
+    std::atomic<bool> stopDistributed(false);
+    std::thread distributedWaiter(distributedLoop, std::ref(*pool), std::ref(*tileCoordinator),
+                                  std::ref(distributing), std::cref(stopDistributed));
+
+    // This replica works for the coordinator at RENDER_COORDINATOR, if set
+    std::atomic<bool> stopTileWorker(false);
+    std::thread tileWorker;
+    if (const char* url = getenv("RENDER_COORDINATOR")) {
+        http_client::Url coordinatorUrl;
+        if (http_client::parseUrl(url, coordinatorUrl)) {
+            tileWorker = std::thread(tileWorkerLoop, std::ref(*pool), coordinatorUrl, std::cref(stopTileWorker));
+        } else {
+            fprintf(stderr, "Ignoring RENDER_COORDINATOR: expected http://host[:port][/prefix], got %s\n", url);
+        }
+    }
+
+    // Frames kept between requests so a later one can add samples to them
+    std::unique_ptr<AccumStore> accumStore(AccumStore::fromEnv());
+
+    // Encoded images of exact renders, served again without rendering
+    std::unique_ptr<RenderCache> renderCache(RenderCache::fromEnv());
+    std::unique_ptr<DiskCache> diskCache(DiskCache::fromEnv()); // outlives restarts
+
+    // Identical renders requested while one is running wait for its result
+    Singleflight<RenderWaiter> renderFlights;
+
     // Main endpoint - returns PNG image directly
-    CROW_ROUTE(app, "/render")([](const crow::request& req) {
-        // Parse parameters with defaults
-        int samples = 25;
-        double sphere1_x = 27, sphere1_y = 16.5, sphere1_z = 47;    // Mirror sphere default
-        double sphere2_x = 73, sphere2_y = 16.5, sphere2_z = 78;    // Glass sphere default
-
-        // Parse samples parameter
-        if (req.url_params.get("samples")) {
-            samples = std::max(1, std::min(1000, atoi(req.url_params.get("samples"))));
-        }
-
-        // Parse sphere1 coordinates (mirror sphere)
-        if (req.url_params.get("s1x")) sphere1_x = atof(req.url_params.get("s1x"));
-        if (req.url_params.get("s1y")) sphere1_y = atof(req.url_params.get("s1y"));
-        if (req.url_params.get("s1z")) sphere1_z = atof(req.url_params.get("s1z"));
-
-        // Parse sphere2 coordinates (glass sphere)
-        if (req.url_params.get("s2x")) sphere2_x = atof(req.url_params.get("s2x"));
-        if (req.url_params.get("s2y")) sphere2_y = atof(req.url_params.get("s2y"));
-        if (req.url_params.get("s2z")) sphere2_z = atof(req.url_params.get("s2z"));
-
-        // Clamp coordinates to reasonable scene bounds
-        sphere1_x = std::max(20.0, std::min(80.0, sphere1_x));
-        sphere1_y = std::max(16.5, std::min(65.0, sphere1_y));
-        sphere1_z = std::max(30.0, std::min(120.0, sphere1_z));
-        
-        sphere2_x = std::max(20.0, std::min(80.0, sphere2_x));
-        sphere2_y = std::max(16.5, std::min(65.0, sphere2_y));
-        sphere2_z = std::max(30.0, std::min(120.0, sphere2_z));
+    CROW_ROUTE(app, "/render")([&pool, &tileCoordinator, &distributing, &accumStore, &renderCache, &diskCache,
+                                &renderFlights](const crow::request& req, crow::response& res) {
+        RenderRequest r;
+        std::string error = parseRenderRequest(req.url_params, r);
+        if (!error.empty()) {
+            res.code = 400;
+            res.end(error);
+            return;
+        }
+        const RenderOptions& opts = r.opts;
 
         printf("Rendering: samples=%d, sphere1=(%.1f,%.1f,%.1f), sphere2=(%.1f,%.1f,%.1f)\n",
-               samples, sphere1_x, sphere1_y, sphere1_z, sphere2_x, sphere2_y, sphere2_z);
+               opts.samples, r.sphere1_x, r.sphere1_y, r.sphere1_z, r.sphere2_x, r.sphere2_y, r.sphere2_z);
+
+        // Build this request's scene; it is never shared with other requests
+        Scene scene = r.scene();
+
+        // Renders against a deadline depend on timing and are never cached
+        std::string cacheKey = r.cacheKey();
+        RenderCache* resultCache = r.cache && opts.budgetMs <= 0 ? renderCache.get() : nullptr;
+        DiskCache* resultDisk = resultCache ? diskCache.get() : nullptr;
+
+        // Exact renders are a function of cacheKey, so its hash is a strong
+        // ETag; a client already holding it needs no render at all
+        std::string etag = opts.budgetMs <= 0 ? etagOf(cacheKey) : "";
+        if (!etag.empty() && etagMatches(req.get_header_value("If-None-Match"), etag)) {
+            res.code = 304;
+            res.set_header("ETag", etag);
+            res.set_header("Cache-Control", kExactCacheControl);
+            res.end();
+            return;
+        }
+
+        if (resultCache) {
+            if (RenderCache::Bytes image = resultCache->get(cacheKey)) {
+                res.code = 200;
+                res.body = *image;
+                res.set_header("Content-Type", r.encoding.contentType());
+                res.set_header("Content-Length", std::to_string(image->size()));
+                res.set_header("ETag", etag);
+                res.set_header("Cache-Control", kExactCacheControl);
+                res.set_header("X-Cache", "HIT");
+                res.end();
+                return;
+            }
+            // Streamed from the file by Crow, never loaded into res.body
+            std::string path = resultDisk->get(cacheKey);
+            if (!path.empty()) {
+                res.set_static_file_info_unsafe(path);
+                if (res.code == 200) {
+                    res.set_header("Content-Type", r.encoding.contentType()); // not the file's extension
+                    res.set_header("ETag", etag);
+                    res.set_header("Cache-Control", kExactCacheControl);
+                    res.set_header("X-Cache", "HIT-DISK");
+                    res.end();
+                    return;
+                }
+            }
+        }
+
+        // Render and encode on the pool, then hand the result back to the
+        // I/O thread of each connection waiting for it to send
+        crow::asio::io_context* io = req.io_context;
+        RenderPool& renderPool = *pool;
+        Coordinator& coordinator = *tileCoordinator;
+        AccumStore* store = r.resume ? accumStore.get() : nullptr;
+
+        // A cacheable render already in flight answers this request too
+        Singleflight<RenderWaiter>* flights = resultCache ? &renderFlights : nullptr;
+        std::string flightKey = cacheKey + (r.resume ? " resume" : " fresh");
+        if (flights && !flights->join(flightKey, {&res, io})) return;
+        crow::response* self = &res;
+        auto waiters = [flights, flightKey, self, io] {
+            return flights ? flights->finish(flightKey) : std::vector<RenderWaiter>{{self, io}};
+        };
+
+        // Sends the result to every request waiting for it, which ends the flight
+        bool distributed = r.distribute;
+        const char* contentType = r.encoding.contentType();
+        auto respond = [waiters, etag, distributed, contentType](
+                           bool ok, const std::shared_ptr<std::vector<unsigned char>>& image_buffer, double waitMs,
+                           const RenderStats& stats) {
+            std::vector<RenderWaiter> all = waiters();
+            for (size_t i = 0; i < all.size(); i++) {
+                crow::response* res = all[i].res;
+                const char* cacheStatus = i == 0 ? "MISS" : "COALESCED";
+                crow::asio::post(*all[i].io, [res, image_buffer, ok, waitMs, stats, cacheStatus, etag, distributed,
+                                              contentType] {
+                    if (!ok) {
+                        res->code = 500;
+                        res->end("Rendering failed");
+                        return;
+                    }
 
-        // Setup scene with new coordinates
-        setupScene(sphere1_x, sphere1_y, sphere1_z, sphere2_x, sphere2_y, sphere2_z);
+                    // Return the image directly
+                    res->code = 200;
+                    res->body = std::string(image_buffer->begin(), image_buffer->end());
+                    res->set_header("Content-Type", contentType);
+                    res->set_header("Content-Length", std::to_string(image_buffer->size()));
+                    if (stats.exact) {
+                        res->set_header("ETag", etag);
+                        res->set_header("Cache-Control", kExactCacheControl);
+                    } else {
+                        res->set_header("Cache-Control", "no-store"); // depends on timing or stored frames
+                    }
+                    res->set_header("X-Cache", cacheStatus);
+                    res->set_header("X-Queue-Wait-Ms", std::to_string(int(waitMs + .5)));
+                    res->set_header("X-Render-Ms", std::to_string(int(stats.renderMs + .5)));
+                    char samplesMean[32];
+                    snprintf(samplesMean, sizeof(samplesMean), "%.1f", stats.samplesMean);
+                    res->set_header("X-Samples", samplesMean);
+                    snprintf(samplesMean, sizeof(samplesMean), "%.1f", stats.samplesResumed);
+                    res->set_header("X-Samples-Resumed", samplesMean);
+                    char tileTimes[128];
+                    snprintf(tileTimes, sizeof(tileTimes), "tiles=%d min=%.2f mean=%.2f p95=%.2f max=%.2f",
+                             stats.tiles, stats.tileMinMs, stats.tileMeanMs, stats.tileP95Ms, stats.tileMaxMs);
+                    res->set_header("X-Tile-Ms", tileTimes);
+                    if (distributed) res->set_header("X-Tiles-Remote", std::to_string(stats.tilesRemote));
+                    res->end();
+                });
+            }
+        };
+
+        // Results are cached before the flight ends, so no later request
+        // renders them again. A render that throws still ends the flight, with
+        // a 500 for every waiter, or later identical requests would join it
+        // forever.
+        DistributedRenders& distributedRenders = distributing;
+        bool queued = renderPool.submit([&renderPool, &coordinator, &distributedRenders, scene, r, store, resultCache,
+                                         resultDisk, respond](double waitMs) {
+            auto image_buffer = std::make_shared<std::vector<unsigned char>>();
+            RenderStats stats;
+            bool ok = false;
+            try {
+                if (r.distribute) {
+                    // Answered from another pool job once the remote tiles are back
+                    startDistributed(renderPool, coordinator, distributedRenders, scene, r,
+                                     [&renderPool, r, resultCache, resultDisk, respond, image_buffer,
+                                      waitMs](bool ok, AccumBuffer& acc, const RenderStats& stats) {
+                        try {
+                            ok = ok && encodeResult(renderPool, acc, r, stats, resultCache, resultDisk, *image_buffer);
+                        } catch (const std::exception& e) {
+                            fprintf(stderr, "Render failed: %s\n", e.what());
+                            ok = false;
+                        }
+                        respond(ok, image_buffer, waitMs, stats);
+                    });
+                    return;
+                }
+                ok = renderRequest(renderPool, scene, r, store, resultCache, resultDisk, *image_buffer, stats);
+            } catch (const std::exception& e) {
+                fprintf(stderr, "Render failed: %s\n", e.what());
+            }
+            respond(ok, image_buffer, waitMs, stats);
+        });
+        if (!queued) {
+            // Requests that joined meanwhile are turned away with this one
+            for (const RenderWaiter& w : waiters()) {
+                crow::response* res = w.res;
+                crow::asio::post(*w.io, [res] {
+                    res->code = 503;
+                    res->set_header("Retry-After", "1");
+                    res->end("Render queue full");
+                });
+            }
+        }
+    });
 
-        // Render to PNG buffer
-        std::vector<unsigned char> png_buffer;
-        if (!renderToPNG(samples, png_buffer)) {
-            return crow::response(500, "Rendering failed");
+    // Many frames in one request, each sent as a part of a multipart/mixed
+    // body as soon as it is rendered
+    CROW_ROUTE(app, "/render/sweep")
+        .methods(crow::HTTPMethod::GET, crow::HTTPMethod::POST)([&pool, &accumStore, &renderCache, &diskCache](
+                                                                    const crow::request& req, crow::response& res) {
+        RenderRequest base;
+        std::string error = parseRenderRequest(req.url_params, base);
+        if (error.empty() && base.distribute) error = "sweeps render locally, without distribute";
+        std::vector<RenderRequest> frames;
+        if (error.empty()) error = parseSweep(req, base, frames);
+        if (!error.empty()) {
+            res.code = 400;
+            res.end(error);
+            return;
         }
 
-        // Return PNG image directly
-        crow::response res(200);
-        res.body = std::string(png_buffer.begin(), png_buffer.end());
-        res.set_header("Content-Type", "image/png");
-        res.set_header("Content-Length", std::to_string(png_buffer.size()));
-        res.set_header("Cache-Control", "no-cache"); // Force fresh renders
+        printf("Rendering sweep: %zu frames, samples=%d\n", frames.size(), base.opts.samples);
+
+        crow::asio::io_context* io = req.io_context;
+        crow::response* self = &res;
+        RenderPool& renderPool = *pool;
+        AccumStore* store = base.resume ? accumStore.get() : nullptr;
+        RenderCache* resultCache = base.cache && base.opts.budgetMs <= 0 ? renderCache.get() : nullptr;
+        DiskCache* resultDisk = resultCache ? diskCache.get() : nullptr;
+
+        // One job for the sweep: its frames spread over the pool like the
+        // tiles within each frame do, and go out as they finish
+        bool queued = renderPool.submit([&renderPool, frames, store, resultCache, resultDisk, self, io](double waitMs) {
+            renderPool.parallelFor(int(frames.size()), [&](int i) {
+                const RenderRequest& r = frames[i];
+                std::string cacheKey = r.cacheKey();
+                RenderCache::Bytes image = resultCache ? resultCache->get(cacheKey) : nullptr;
+                const char* cacheStatus = "HIT";
+                if (!image && resultDisk) {
+                    std::string path = resultDisk->get(cacheKey);
+                    std::ifstream in(path, std::ios::binary);
+                    std::stringstream bytes;
+                    if (!path.empty() && in && (bytes << in.rdbuf())) {
+                        image = std::make_shared<const std::string>(bytes.str());
+                        cacheStatus = "HIT-DISK";
+                    }
+                }
+                RenderStats stats;
+                stats.exact = true;
+                if (!image) {
+                    std::vector<unsigned char> buffer;
+                    cacheStatus = "MISS";
+                    try {
+                        if (renderRequest(renderPool, r.scene(), r, store, resultCache, resultDisk, buffer, stats)) {
+                            image = std::make_shared<const std::string>(buffer.begin(), buffer.end());
+                        }
+                    } catch (const std::exception& e) {
+                        fprintf(stderr, "Render failed: %s\n", e.what()); // goes out as a failed part
+                    }
+                }
+
+                std::ostringstream part;
+                part << "--" << kSweepBoundary << "\r\n";
+                char scene[256];
+                snprintf(scene, sizeof(scene), "s1x=%g&s1y=%g&s1z=%g&s2x=%g&s2y=%g&s2z=%g", r.sphere1_x,
+                         r.sphere1_y, r.sphere1_z, r.sphere2_x, r.sphere2_y, r.sphere2_z);
+                part << "X-Frame: " << i << "\r\nX-Scene: " << scene << "\r\nX-Queue-Wait-Ms: " << int(waitMs + .5)
+                     << "\r\n";
+                if (!image) {
+                    const char* failed = "Rendering failed";
+                    part << "X-Status: 500\r\nContent-Type: text/plain\r\nContent-Length: " << strlen(failed)
+                         << "\r\n\r\n" << failed << "\r\n";
+                } else {
+                    part << "X-Status: 200\r\nContent-Type: " << r.encoding.contentType()
+                         << "\r\nContent-Length: " << image->size() << "\r\nX-Cache: " << cacheStatus << "\r\n";
+                    if (stats.exact) part << "ETag: " << etagOf(cacheKey) << "\r\n";
+                    if (cacheStatus[0] == 'M') {
+                        char samples[32];
+                        snprintf(samples, sizeof(samples), "%.1f", stats.samplesMean);
+                        part << "X-Render-Ms: " << int(stats.renderMs + .5) << "\r\nX-Samples: " << samples << "\r\n";
+                    }
+                    part << "\r\n" << *image << "\r\n";
+                }
+                auto chunk = std::make_shared<std::string>(part.str());
+                crow::asio::post(*io, [self, chunk] { self->write_chunk(*chunk); });
+            });
+            crow::asio::post(*io, [self] { self->end(std::string("--") + kSweepBoundary + "--\r\n"); });
+        });
+        if (!queued) {
+            res.code = 503;
+            res.set_header("Retry-After", "1");
+            res.end("Render queue full");
+            return;
+        }
+
+        // Headers go out now; parts follow as chunks
+        res.code = 200;
+        res.set_header("Content-Type", std::string("multipart/mixed; boundary=") + kSweepBoundary);
+        res.set_header("Cache-Control", "no-store");
+        res.set_header("X-Accel-Buffering", "no");
+        res.write_chunk("");
+    });
+
+    // A frame's tiles sent as each finishes, over chunked transfer encoding
+    CROW_ROUTE(app, "/render/stream")([&pool](const crow::request& req, crow::response& res) {
+        RenderRequest r;
+        std::string error = parseRenderRequest(req.url_params, r);
+        if (error.empty() && r.distribute) error = "stream renders locally, without distribute";
+        if (!error.empty()) {
+            res.code = 400;
+            res.end(error);
+            return;
+        }
+
+        crow::asio::io_context* io = req.io_context;
+        crow::response* self = &res;
+        RenderPool& renderPool = *pool;
+        bool queued = renderPool.submit([&renderPool, r, self, io](double) {
+            AccumBuffer acc(kImageW, kImageH);
+            RenderStats stats;
+            renderFrame(renderPool, r.scene(), r.opts, acc, &stats, [&acc, self, io](const Tile& t) {
+                auto record = std::make_shared<std::string>(tileRecord(acc, t));
+                crow::asio::post(*io, [self, record] { self->write_chunk(*record); });
+            });
+            std::vector<unsigned char> image;
+            bool ok = encodeImage(renderPool, acc, r.encoding, image);
+            auto last = std::make_shared<std::string>(
+                ok ? streamRecord("DONE", std::string(image.begin(), image.end())) : streamRecord("FAIL", "Encoding failed"));
+            crow::asio::post(*io, [self, last] { self->end(*last); });
+        });
+        if (!queued) {
+            res.code = 503;
+            res.set_header("Retry-After", "1");
+            res.end("Render queue full");
+            return;
+        }
+
+        // Headers and the frame's size go out now, well before any tile
+        res.code = 200;
+        res.set_header("Content-Type", "application/octet-stream");
+        res.set_header("Cache-Control", "no-store");
+        res.set_header("X-Accel-Buffering", "no"); // nginx-style proxies pass chunks on as they come
+        res.write_chunk(streamRecord("HEAD", streamWords({uint32_t(kImageW), uint32_t(kImageH)})));
+    });
+
+    // Interactive sessions over WebSocket, refining a frame as the client
+    // changes its options
+    std::atomic<int> sessionsOpen(0);
+    CROW_WEBSOCKET_ROUTE(app, "/session")
+        .max_payload(65536)
+        .onopen([&sessionsOpen](crow::websocket::connection& conn) {
+            auto session = std::make_shared<Session>();
+            session->conn = &conn;
+            conn.userdata(new std::shared_ptr<Session>(session));
+            sessionsOpen++;
+        })
+        .onclose([&sessionsOpen](crow::websocket::connection& conn, const std::string&, uint16_t) {
+            auto* session = static_cast<std::shared_ptr<Session>*>(conn.userdata());
+            if (!session) return;
+            {
+                std::lock_guard<std::mutex> lk((*session)->m);
+                (*session)->conn = nullptr;
+            }
+            delete session;
+            conn.userdata(nullptr);
+            sessionsOpen--;
+        })
+        .onmessage([&pool](crow::websocket::connection& conn, const std::string& data, bool isBinary) {
+            auto* userdata = static_cast<std::shared_ptr<Session>*>(conn.userdata());
+            if (!userdata || isBinary) return;
+            std::shared_ptr<Session> session = *userdata;
+            RenderRequest r;
+            int fps = session->fps;
+            std::string error = parseSessionUpdate(data, r, fps);
+            if (!error.empty()) {
+                conn.send_text("error: " + error);
+                return;
+            }
+
+            {
+                std::lock_guard<std::mutex> lk(session->m);
+                session->request = r;
+                session->fps = fps;
+                session->update++;
+                if (session->rendering) return; // its next pass picks the update up
+                session->rendering = true;
+            }
+            queueSessionPass(*pool, session);
+        });
+
+    // Sample-parallel renders: one replica's share of a frame's samples
+    CROW_ROUTE(app, "/render/accum")([&pool](const crow::request& req, crow::response& res) {
+        RenderRequest r;
+        std::string error = parseRenderRequest(req.url_params, r);
+        if (error.empty() && (r.opts.budgetMs > 0 || r.opts.noise > 0)) {
+            error = "accum renders a fixed sample range, without budget_ms or noise";
+        }
+        if (!error.empty()) {
+            res.code = 400;
+            res.end(error);
+            return;
+        }
+        uint32_t first = 0;
+        if (req.url_params.get("first")) first = uint32_t(std::max(0, std::min(1 << 20, atoi(req.url_params.get("first")))));
+
+        crow::asio::io_context* io = req.io_context;
+        crow::response* self = &res;
+        RenderPool& renderPool = *pool;
+        bool queued = renderPool.submit([&renderPool, r, first, self, io](double waitMs) {
+            RenderStats stats;
+            auto body = std::make_shared<std::string>(renderSampleRange(renderPool, r.scene(), r, first, stats));
+            crow::asio::post(*io, [self, body, first, r, waitMs, stats] {
+                self->code = 200;
+                self->body = std::move(*body);
+                self->set_header("Content-Type", "application/octet-stream");
+                self->set_header("X-Sample-First", std::to_string(first));
+                self->set_header("X-Samples", std::to_string(r.opts.samples));
+                self->set_header("X-Queue-Wait-Ms", std::to_string(int(waitMs + .5)));
+                self->set_header("X-Render-Ms", std::to_string(int(stats.renderMs + .5)));
+                self->end();
+            });
+        });
+        if (!queued) {
+            res.code = 503;
+            res.set_header("Retry-After", "1");
+            res.end("Render queue full");
+        }
+    });
+
+    // ...and the image of any number of them added up
+    CROW_ROUTE(app, "/render/merge").methods(crow::HTTPMethod::POST)([&pool](const crow::request& req,
+                                                                            crow::response& res) {
+        crow::asio::io_context* io = req.io_context;
+        crow::response* self = &res;
+        auto data = std::make_shared<std::string>(req.body);
+        RenderPool& renderPool = *pool;
+        Encoding enc;
+        std::string error = parseEncoding(req.url_params, enc);
+        if (!error.empty()) {
+            res.code = 400;
+            res.end(error);
+            return;
+        }
+        bool queued = renderPool.submit([&renderPool, data, enc, self, io](double) {
+            AccumBuffer acc(kImageW, kImageH);
+            bool contiguous = false;
+            std::string error = mergeSampleRanges(*data, acc, contiguous);
+            auto image = std::make_shared<std::vector<unsigned char>>();
+            bool ok = error.empty() && encodeImage(renderPool, acc, enc, *image);
+            double samples = double(acc.totalSamples()) / (acc.w * acc.h);
+            const char* contentType = enc.contentType();
+            crow::asio::post(*io, [self, error, ok, image, samples, contiguous, contentType] {
+                if (!ok) {
+                    self->code = error.empty() ? 500 : 400;
+                    self->end(error.empty() ? "Encoding failed" : error);
+                    return;
+                }
+                self->code = 200;
+                self->body = std::string(image->begin(), image->end());
+                self->set_header("Content-Type", contentType);
+                char mean[32];
+                snprintf(mean, sizeof(mean), "%.1f", samples);
+                self->set_header("X-Samples", mean);
+                self->set_header("X-Samples-Contiguous", contiguous ? "1" : "0");
+                self->end();
+            });
+        });
+        if (!queued) {
+            res.code = 503;
+            res.set_header("Retry-After", "1");
+            res.end("Render queue full");
+        }
+    });
+
+    // Distributed renders: worker replicas lease tiles here, one line each
+    CROW_ROUTE(app, "/tiles/lease")([&tileCoordinator](const crow::request& req) {
+        int count = req.url_params.get("count") ? std::max(1, std::min(256, atoi(req.url_params.get("count")))) : 1;
+        std::vector<Coordinator::Lease> leases = tileCoordinator->lease(size_t(count));
+        if (leases.empty()) return crow::response(204);
+        std::string body;
+        for (const Coordinator::Lease& l : leases) {
+            body += std::to_string(l.job) + " " + std::to_string(l.tile) + " " + l.spec + "\n";
+        }
+        crow::response res(200, body);
+        res.set_header("Content-Type", "text/plain");
         return res;
     });
 
+    // ...and post each rendered tile back, packed by AccumBuffer::pack()
+    CROW_ROUTE(app, "/tiles/result").methods(crow::HTTPMethod::POST)([&tileCoordinator](const crow::request& req) {
+        if (!req.url_params.get("job") || !req.url_params.get("tile")) {
+            return crow::response(400, "job and tile are required");
+        }
+        uint64_t job = strtoull(req.url_params.get("job"), nullptr, 10);
+        int tile = atoi(req.url_params.get("tile"));
+        switch (tileCoordinator->complete(job, tile, false, [&req](DistributedFrame& f, int t) {
+            return f.acc.unpack(req.body, f.tiles[t].x0, f.tiles[t].y0, f.tiles[t].x1, f.tiles[t].y1);
+        })) {
+        case Coordinator::ACCEPTED: return crow::response(200, "accepted");
+        case Coordinator::DUPLICATE: return crow::response(200, "duplicate");
+        case Coordinator::GONE: return crow::response(410, "job finished or failed");
+        default: return crow::response(400, "result does not match the tile");
+        }
+    });
+
     // Help endpoint
     CROW_ROUTE(app, "/")([](const crow::request& req) {
         std::string help = R"(Path Tracer API
@@ -251,6 +2159,45 @@ Parameters:
 - samples: Number of samples (1-1000, default: 25)
 - s1x, s1y, s1z: Mirror sphere position (default: 27, 16.5, 47)
 - s2x, s2y, s2z: Glass sphere position (default: 73, 16.5, 78)
+- engine: Integrator, recursive or wavefront (default: recursive)
+- packet: Camera rays traced per SIMD packet (recursive engine), 1, 4, 8 or 16 (default: 8)
+- split: Bounces at which glass traces both reflection and refraction, 0-4
+  (default: 2; deeper hits pick one by Russian roulette; recursive engine)
+- nee: 1 to sample the light directly at diffuse hits with MIS, 0 to rely on
+  bounces finding it (default: 1)
+- seed: Random seed (default: 0); a given seed renders the same image on any
+  tile size, packet width or machine
+- sampler: Sample sequence, sobol, halton, bluenoise or random (default: sobol)
+- noise: Adaptive sampling threshold, the relative noise at which a pixel stops
+  (e.g. 0.02; default: 0, every pixel takes `samples`). samples is then the
+  frame's average budget, spent where the image is still noisy
+- max_samples: Most samples an adaptive pixel may take (samples-4000,
+  default: 4 x samples)
+- budget_ms: Deadline in milliseconds from the request's arrival (1-3600000);
+  passes of growing sample counts refine the image until it nearly expires,
+  then the best image so far is returned, its samples in X-Samples. samples
+  caps the count (default: 1000 here)
+- resume: 1 to continue this scene's stored frame, rendering only the samples
+  it lacks (a frame with more is returned as is), and store the result; 0 to
+  render from scratch and store nothing (default: 1)
+- cache: 1 to answer from the render cache when these exact options were
+  rendered before, or from an identical render already running, and cache the
+  result; 0 to bypass both (default: 1)
+- tile: Tile edge in pixels for the render scheduler (4-256, default: 32)
+- order: Tile order, morton, hilbert or scanline (default: morton)
+- format: Output, png, qoi (lossless, much faster to encode, larger), ppm or
+  pam (uncompressed 8-bit RGB), jpeg (lossy, smallest), or the linear radiance
+  before clamping and gamma, to tone map elsewhere: hdr (Radiance RGBE) or
+  float32 ("RF32", uint32 width and height, then float RGB rows from the top,
+  all little-endian) (default: png)
+- png_level: PNG compression, 0 (stored, fastest) to 9 (smallest) (default: 6)
+- quality: JPEG quality (1-100, default: 90)
+- distribute: 1 to coordinate the frame across replicas: its tiles are queued
+  here for worker replicas (see RENDER_COORDINATOR) to lease while this one
+  renders them too, so send it to the replica they lease from; the image is
+  the same as a local render's. Fixed sample counts only, so not with
+  budget_ms or noise; starts from scratch rather than a stored frame
+  (default: 0)
 
 Examples:
 /render
@@ -263,7 +2210,91 @@ Coordinate bounds:
 - Y: 16.5-65 (sphere radius to ceiling)
 - Z: 30-120 (scene depth)
 
-Returns: PNG image directly
+Returns: the image directly, Content-Type by format (503 with Retry-After when
+the render queue is full)
+Timing headers: X-Queue-Wait-Ms, X-Render-Ms, X-Tile-Ms (per-tile min/mean/p95/max),
+X-Samples (samples per subpixel, averaged over the frame), X-Tiles-Remote
+(distributed renders: tiles worker replicas rendered), X-Samples-Resumed
+(of which came from the stored frame), ETag (exact renders only: not budget_ms
+ones, nor stored frames that already had more samples; send it back in
+If-None-Match for a 304 without rendering), X-Cache (HIT or HIT-DISK when served from the
+render cache's memory or disk tier, which only send Content-*, ETag and X-Cache headers;
+COALESCED when an identical request already rendering answered this one too)
+
+Sweeps: GET /render/sweep renders many frames in one request, with the
+parameters above (but distribute) for every frame plus
+- param: Sphere coordinate to step, s1x, s1y, s1z, s2x, s2y or s2z
+- from, to: First and last value of param (both required)
+- step: Step between frames (default: 1)
+or POST /render/sweep with the same query parameters and a body of one frame
+per line, each a query string of sphere coordinates (e.g. s1x=40&s2z=90).
+At most 256 frames. Frames render in parallel on the render pool and return as
+one multipart/mixed body, sent over chunked transfer encoding, each part as
+soon as its frame is done; each part carries X-Frame (index into the sweep),
+X-Scene (its sphere coordinates), X-Queue-Wait-Ms, X-Status (200, or 500 for
+a frame that failed, then a text/plain part), Content-Type and Content-Length,
+and for images X-Cache, ETag, and for rendered frames X-Render-Ms and
+X-Samples.
+
+Example: /render/sweep?samples=50&param=s1x&from=40&to=60&s1y=20&s1z=50
+
+Other endpoints:
+- /render/accum: the /render parameters plus first (default: 0) render
+  samples first to first + samples - 1 of every subpixel and return the raw
+  accumulation buffer (application/octet-stream: a header of ten uint32, then
+  per pixel its sample count, 12 float subpixel RGB sums and two double
+  luminance sums, host byte order). Replicas rendering the same options with
+  disjoint ranges split a frame by samples; fixed sample counts only
+- /render/stream: the /render options (but distribute), the frame sent as it
+  renders over chunked transfer encoding: records of a 4-byte kind, a uint32
+  length and a payload, integers little-endian. "HEAD" (width, height) comes
+  at once; then a "TILE" (x and y from the top, width, height, 8-bit RGB rows
+  from the top) each time a tile finishes a pass, so tiles repeat as
+  budget_ms or noise refine them; then "DONE" with the image as format asks,
+  or "FAIL" with a message. Always renders afresh, without the caches
+- POST /render/merge: a body of /render/accum buffers, concatenated, returns
+  the image of their samples together, which is the one a single render of
+  them all gives when the ranges run from 0 without gaps
+  (X-Samples-Contiguous: 1); 400 for overlapping ranges or mixed options.
+  Takes format, png_level and quality
+- /session: WebSocket for interactive use. Each text message is an update, a
+  /render query string (but budget_ms, noise and distribute) plus fps, the
+  frame rate to aim for (1-60, default: 10); format defaults to jpeg. The
+  frame restarts with every update and comes back as binary messages, each
+  the update's number (counting from 1) and the samples per pixel so far as
+  uint32 little-endian, then the image: first at one sample, then refined
+  about once a frame interval until samples is reached. Outdated frames are
+  never sent, nor are frames but the last while the client is still
+  receiving the one before; a bad update gets an "error: " text message, and
+  so does a pass the full render queue turned away (send an update to go on)
+- /tiles/lease?count=N: up to N tiles of distributed renders for a worker
+  replica, one "<job> <tile> <render query>" line each (204 when there are none)
+- POST /tiles/result?job=J&tile=T: a worker's rendered tile
+- /health: liveness check
+- /metrics: render pool queue depth, wait time and job counters, stored frame
+  counts, render cache hits and misses per tier, coalesced requests,
+  distributed tiles, open sessions (Prometheus text)
+
+Environment:
+- RENDER_THREADS: render worker count (default: available CPUs)
+- RENDER_QUEUE_DEPTH: max renders waiting for a worker (default: 16)
+- RENDER_PIN: pin render workers to CPUs (default: 1)
+- RENDER_ACCUM_MB: memory for stored frames, least recently used evicted first
+  (default: 512, 0 to disable)
+- RENDER_CACHE_MB: memory for cached images, least recently used evicted first
+  (default: 256, 0 to disable)
+- RENDER_CACHE_DIR: directory for the render cache's disk tier, kept across
+  restarts (default: unset, no disk tier)
+- RENDER_CACHE_DISK_MB: room for the disk tier (default: 4096)
+- RENDER_PORT: port to listen on (default: 8082)
+- RENDER_COORDINATOR: http://host[:port][/prefix] of a replica whose
+  distributed renders this one works on, each leased tile a job in its render
+  queue; tiles are leased from and posted back to it, so it must reach that
+  one replica every time (its own service or pod address), never a load
+  balancer in front of several (default: unset)
+- RENDER_TILE_LEASE_MS: time a worker has for a leased tile before it is
+  leased again (default: 60000)
+- RENDER_TILE_ATTEMPTS: leases of one tile before its render fails (default: 4)
 )";
         return crow::response(200, help);
     });
@@ -273,13 +2304,77 @@ Returns: PNG image directly
         return crow::response(200, "OK");
     });
 
-    std::cout << "Path Tracer API Server starting on port 8082\n";
+    // Prometheus metrics for the render pool
+    CROW_ROUTE(app, "/metrics")([&pool, &tileCoordinator, &accumStore, &renderCache, &diskCache, &renderFlights,
+                                 &sessionsOpen]{
+        RenderPool::Stats st = pool->stats();
+        AccumStore::Stats acc = accumStore->stats();
+        RenderCache::Stats cache = renderCache->stats();
+        DiskCache::Stats disk = diskCache->stats();
+        Singleflight<RenderWaiter>::Stats flights = renderFlights.stats();
+        Coordinator::Stats tiles = tileCoordinator->stats();
+        std::ostringstream out;
+        out << "render_workers " << st.workers << "\n"
+            << "render_queue_capacity " << st.capacity << "\n"
+            << "render_queue_depth " << st.queued << "\n"
+            << "render_jobs_active " << st.active << "\n"
+            << "render_jobs_completed_total " << st.completed << "\n"
+            << "render_jobs_rejected_total " << st.rejected << "\n"
+            << "render_queue_wait_seconds_sum " << st.waitSumMs / 1000 << "\n"
+            << "render_queue_wait_seconds_count " << st.waitCount << "\n"
+            << "render_queue_wait_seconds_max " << st.waitMaxMs / 1000 << "\n"
+            << "render_accum_entries " << acc.entries << "\n"
+            << "render_accum_bytes " << acc.bytes << "\n"
+            << "render_accum_capacity_bytes " << acc.capacityBytes << "\n"
+            << "render_accum_hits_total " << acc.hits << "\n"
+            << "render_accum_misses_total " << acc.misses << "\n"
+            << "render_accum_evictions_total " << acc.evictions << "\n"
+            << "render_cache_entries " << cache.entries << "\n"
+            << "render_cache_bytes " << cache.bytes << "\n"
+            << "render_cache_capacity_bytes " << cache.capacityBytes << "\n"
+            << "render_cache_hits_total " << cache.hits << "\n"
+            << "render_cache_misses_total " << cache.misses << "\n"
+            << "render_cache_evictions_total " << cache.evictions << "\n"
+            << "render_disk_cache_entries " << disk.entries << "\n"
+            << "render_disk_cache_bytes " << disk.bytes << "\n"
+            << "render_disk_cache_capacity_bytes " << disk.capacityBytes << "\n"
+            << "render_disk_cache_hits_total " << disk.hits << "\n"
+            << "render_disk_cache_misses_total " << disk.misses << "\n"
+            << "render_disk_cache_evictions_total " << disk.evictions << "\n"
+            << "render_disk_cache_write_errors_total " << disk.writeErrors << "\n"
+            << "render_flights_in_progress " << flights.inFlight << "\n"
+            << "render_flights_led_total " << flights.led << "\n"
+            << "render_flights_joined_total " << flights.joined << "\n"
+            << "render_distributed_jobs " << tiles.jobs << "\n"
+            << "render_distributed_tiles_pending " << tiles.pending << "\n"
+            << "render_distributed_tiles_leased " << tiles.leased << "\n"
+            << "render_distributed_tiles_local_total " << tiles.tilesLocal << "\n"
+            << "render_distributed_tiles_remote_total " << tiles.tilesRemote << "\n"
+            << "render_distributed_leases_expired_total " << tiles.expired << "\n"
+            << "render_distributed_jobs_failed_total " << tiles.jobsFailed << "\n"
+            << "render_sessions_open " << sessionsOpen << "\n";
+        crow::response res(200, out.str());
+        res.set_header("Content-Type", "text/plain; version=0.0.4");
+        return res;
+    });
+
+    int port = 8082;
+    if (const char* v = getenv("RENDER_PORT")) port = atoi(v);
+    std::cout << "Path Tracer API Server starting on port " << port << " (" << sphere_kernels::activeName()
+              << " intersection kernel)\n";
     std::cout << "Usage:\n";
     std::cout << "  GET /render?samples=N&s1x=X&s1y=Y&s1z=Z&s2x=X&s2y=Y&s2z=Z\n";
+    std::cout << "  GET /render/sweep?param=s1x&from=A&to=B&step=S&samples=N...\n";
+    std::cout << "  GET /render/stream?samples=N... (tiles as they finish)\n";
     std::cout << "  GET / (for help)\n";
+    std::cout << "  GET /metrics\n";
     std::cout << "\nExample: curl 'http://0.0.0.0:8082/render?samples=50&s1x=40&s2x=60' > output.png\n\n";
     
     // app.port(8082).multithreaded().run();
-    app.port(8082).multithreaded().run();
+    app.port(uint16_t(port)).multithreaded().run();
+    stopTileWorker = true;
+    if (tileWorker.joinable()) tileWorker.join();
+    stopDistributed = true;
+    distributedWaiter.join();
     return 0;
 }
@@ -0,0 +1,304 @@
+#pragma once
+
+// PNG encoder that uses every render worker.
+//
+// Rows are filtered in parallel (each picks the filter with the smallest sum
+// of absolute values, as stb_image_write does), then split into bands of
+// rows deflated independently: every band but the last ends in an empty
+// stored block, which leaves it byte aligned and not final, so the bands
+// concatenate into one valid zlib stream. Each band goes out as its own IDAT
+// chunk with its own CRC, and the stream's Adler-32 is combined from the
+// bands' and sent in a last small IDAT chunk. Matches never reach into an
+// earlier band, which costs a little ratio at band edges.
+//
+// Deflate uses the fixed Huffman codes with greedy hash-chain matching;
+// level 0 stores the rows unfiltered and uncompressed, levels 1-9 search
+// longer match chains.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "render_pool.h"
+
+namespace png_encoder {
+
+const int kDefaultLevel = 6;
+
+inline uint32_t crc32(const unsigned char* data, size_t n, uint32_t crc = 0) {
+    static const struct Table {
+        uint32_t v[256];
+        Table() {
+            for (uint32_t i = 0; i < 256; i++) {
+                uint32_t c = i;
+                for (int k = 0; k < 8; k++) c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                v[i] = c;
+            }
+        }
+    } table;
+    crc = ~crc;
+    for (size_t i = 0; i < n; i++) crc = table.v[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+const uint32_t kAdlerBase = 65521;
+
+inline uint32_t adler32(const unsigned char* data, size_t n) {
+    uint32_t a = 1, b = 0;
+    while (n > 0) {
+        size_t run = std::min<size_t>(n, 5552); // largest run whose sums fit 32 bits
+        for (size_t i = 0; i < run; i++) {
+            a += data[i];
+            b += a;
+        }
+        a %= kAdlerBase, b %= kAdlerBase;
+        data += run, n -= run;
+    }
+    return b << 16 | a;
+}
+
+// Adler-32 of the concatenation of a (any length) and b (n2 bytes)
+inline uint32_t adler32Combine(uint32_t a, uint32_t b, size_t n2) {
+    uint32_t rem = uint32_t(n2 % kAdlerBase);
+    uint32_t sum1 = a & 0xffff, sum2 = uint32_t(uint64_t(rem) * sum1 % kAdlerBase);
+    sum1 += (b & 0xffff) + kAdlerBase - 1;
+    sum2 += (a >> 16) + (b >> 16) + kAdlerBase - rem;
+    if (sum1 >= kAdlerBase) sum1 -= kAdlerBase;
+    if (sum1 >= kAdlerBase) sum1 -= kAdlerBase;
+    if (sum2 >= 2 * kAdlerBase) sum2 -= 2 * kAdlerBase;
+    if (sum2 >= kAdlerBase) sum2 -= kAdlerBase;
+    return sum2 << 16 | sum1;
+}
+
+// Deflate bit writer, least significant bit first
+struct BitWriter {
+    std::vector<unsigned char>& out;
+    uint32_t bits = 0;
+    int count = 0;
+
+    void put(uint32_t value, int n) {
+        bits |= value << count;
+        count += n;
+        while (count >= 8) {
+            out.push_back((unsigned char)bits);
+            bits >>= 8;
+            count -= 8;
+        }
+    }
+
+    // Huffman codes go most significant bit first
+    void putCode(uint32_t code, int n) {
+        uint32_t rev = 0;
+        for (int i = 0; i < n; i++) rev |= ((code >> i) & 1) << (n - 1 - i);
+        put(rev, n);
+    }
+
+    void align() {
+        if (count > 0) put(0, 8 - count);
+    }
+};
+
+inline void putLiteral(BitWriter& bw, int v) {
+    if (v < 144) bw.putCode(0x30 + v, 8);
+    else if (v < 256) bw.putCode(0x190 + v - 144, 9);
+    else if (v < 280) bw.putCode(v - 256, 7);
+    else bw.putCode(0xc0 + v - 280, 8);
+}
+
+inline void putMatch(BitWriter& bw, int len, int dist) {
+    static const uint16_t lenBase[] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                       31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static const uint8_t lenExtra[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                       2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    static const uint16_t distBase[] = {1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+                                        33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+                                        1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+    static const uint8_t distExtra[] = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                        6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+    int l = 28;
+    while (lenBase[l] > len) l--;
+    putLiteral(bw, 257 + l);
+    bw.put(len - lenBase[l], lenExtra[l]);
+    int d = 29;
+    while (distBase[d] > dist) d--;
+    bw.putCode(d, 5);
+    bw.put(dist - distBase[d], distExtra[d]);
+}
+
+// Deflates data as fixed-Huffman blocks, ending in a final block when last
+// and else in an empty stored block
+inline void deflateBand(const unsigned char* data, size_t n, int level, bool last, std::vector<unsigned char>& out) {
+    BitWriter bw{out};
+    if (level <= 0) {
+        size_t pos = 0;
+        do {
+            size_t len = std::min<size_t>(n - pos, 65535);
+            bw.put(last && pos + len == n, 1);
+            bw.put(0, 2);
+            bw.align();
+            bw.put(uint32_t(len), 16);
+            bw.put(uint32_t(~len & 0xffff), 16);
+            out.insert(out.end(), data + pos, data + pos + len);
+            pos += len;
+        } while (pos < n);
+        if (!last) {
+            bw.put(0, 3);
+            bw.align();
+            bw.put(0, 16);
+            bw.put(0xffff, 16);
+        }
+        return;
+    }
+
+    const int kWindow = 32768, kHashBits = 15, kMaxMatch = 258;
+    int maxChain = 1 << std::min(level, 9); // 2 at level 1 .. 512 at level 9
+    std::vector<int32_t> head(1 << kHashBits, -1), prev(n);
+    auto hash = [&](size_t i) {
+        uint32_t v = uint32_t(data[i]) | uint32_t(data[i + 1]) << 8 | uint32_t(data[i + 2]) << 16;
+        return (v * 2654435761u) >> (32 - kHashBits);
+    };
+    auto insert = [&](size_t i) {
+        if (i + 2 >= n) return;
+        uint32_t hv = hash(i);
+        prev[i] = head[hv];
+        head[hv] = int32_t(i);
+    };
+
+    bw.put(last, 1);
+    bw.put(1, 2); // fixed Huffman codes
+    size_t i = 0;
+    while (i < n) {
+        int bestLen = 0, bestDist = 0;
+        if (i + 2 < n) {
+            int limit = int(std::min<size_t>(kMaxMatch, n - i)), chain = maxChain;
+            for (int32_t j = head[hash(i)]; j >= 0 && int(i - j) <= kWindow && chain-- > 0; j = prev[j]) {
+                if (data[j + bestLen] != data[i + bestLen]) continue;
+                int len = 0;
+                while (len < limit && data[j + len] == data[i + len]) len++;
+                if (len > bestLen) {
+                    bestLen = len, bestDist = int(i - j);
+                    if (len == limit) break;
+                }
+            }
+        }
+        if (bestLen >= 3) {
+            putMatch(bw, bestLen, bestDist);
+            for (int k = 0; k < bestLen; k++) insert(i + k);
+            i += bestLen;
+        } else {
+            putLiteral(bw, data[i]);
+            insert(i);
+            i++;
+        }
+    }
+    putLiteral(bw, 256); // end of block
+    if (!last) {
+        bw.put(0, 3); // empty stored block: aligns the band for the next one
+        bw.align();
+        bw.put(0, 16);
+        bw.put(0xffff, 16);
+    }
+    bw.align();
+}
+
+// Filters row y of an RGB image into out (filter byte, then the row)
+inline void filterRow(const unsigned char* rgb, int w, int y, bool choose, unsigned char* out) {
+    size_t stride = size_t(w) * 3;
+    const unsigned char* row = rgb + y * stride;
+    const unsigned char* up = y > 0 ? row - stride : nullptr;
+    auto predict = [&](int type, size_t i) -> int {
+        int a = i >= 3 ? row[i - 3] : 0, b = up ? up[i] : 0, c = up && i >= 3 ? up[i - 3] : 0;
+        switch (type) {
+        case 1: return a;
+        case 2: return b;
+        case 3: return (a + b) >> 1;
+        case 4: {
+            int p = a + b - c, pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+            return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+        }
+        default: return 0;
+        }
+    };
+    int best = 0;
+    if (choose) {
+        long bestCost = -1;
+        for (int type = 0; type < 5; type++) {
+            long cost = 0;
+            for (size_t i = 0; i < stride; i++) cost += abs((signed char)(row[i] - predict(type, i)));
+            if (bestCost < 0 || cost < bestCost) bestCost = cost, best = type;
+        }
+    }
+    out[0] = (unsigned char)best;
+    for (size_t i = 0; i < stride; i++) out[1 + i] = (unsigned char)(row[i] - predict(best, i));
+}
+
+inline void putChunk(std::vector<unsigned char>& png, const char* type, const unsigned char* data, size_t n,
+                     uint32_t crc) {
+    unsigned char len[4] = {(unsigned char)(n >> 24), (unsigned char)(n >> 16), (unsigned char)(n >> 8),
+                            (unsigned char)n};
+    png.insert(png.end(), len, len + 4);
+    png.insert(png.end(), type, type + 4);
+    png.insert(png.end(), data, data + n);
+    unsigned char c[4] = {(unsigned char)(crc >> 24), (unsigned char)(crc >> 16), (unsigned char)(crc >> 8),
+                          (unsigned char)crc};
+    png.insert(png.end(), c, c + 4);
+}
+
+inline uint32_t chunkCrc(const char* type, const unsigned char* data, size_t n) {
+    return crc32(data, n, crc32((const unsigned char*)type, 4));
+}
+
+// Encodes a w x h 8-bit RGB image, rows top to bottom, at level 0-9
+inline std::vector<unsigned char> encode(RenderPool& pool, const unsigned char* rgb, int w, int h, int level) {
+    level = std::max(0, std::min(9, level));
+    size_t rowBytes = size_t(w) * 3 + 1;
+    std::vector<unsigned char> filtered(rowBytes * h);
+    const int kBandRows = 16;
+    int bands = (h + kBandRows - 1) / kBandRows;
+    pool.parallelFor(bands, [&](int b) {
+        for (int y = b * kBandRows; y < std::min(h, (b + 1) * kBandRows); y++)
+            filterRow(rgb, w, y, level > 0, &filtered[y * rowBytes]);
+    });
+
+    // Deflate bands of at least ~128 KB, one IDAT chunk each
+    int rowsPerBand = std::max(kBandRows, int((128 << 10) / rowBytes));
+    int deflateBands = (h + rowsPerBand - 1) / rowsPerBand;
+    std::vector<std::vector<unsigned char>> idat(deflateBands);
+    std::vector<uint32_t> crcs(deflateBands), adlers(deflateBands);
+    pool.parallelFor(deflateBands, [&](int b) {
+        int y0 = b * rowsPerBand, y1 = std::min(h, y0 + rowsPerBand);
+        const unsigned char* data = &filtered[y0 * rowBytes];
+        size_t n = (y1 - y0) * rowBytes;
+        if (b == 0) idat[b] = {0x78, (unsigned char)(level == 0 ? 0x01 : level < 6 ? 0x5e : level == 6 ? 0x9c : 0xda)};
+        deflateBand(data, n, level, b == deflateBands - 1, idat[b]);
+        crcs[b] = chunkCrc("IDAT", idat[b].data(), idat[b].size());
+        adlers[b] = adler32(data, n);
+    });
+    uint32_t adler = adlers[0];
+    for (int b = 1; b < deflateBands; b++) {
+        int y0 = b * rowsPerBand, y1 = std::min(h, y0 + rowsPerBand);
+        adler = adler32Combine(adler, adlers[b], (y1 - y0) * rowBytes);
+    }
+
+    size_t size = 8 + 25 + 12 + 16;
+    for (auto& d : idat) size += d.size() + 12;
+    std::vector<unsigned char> png;
+    png.reserve(size);
+    static const unsigned char signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    png.insert(png.end(), signature, signature + 8);
+    unsigned char ihdr[13] = {(unsigned char)(w >> 24), (unsigned char)(w >> 16), (unsigned char)(w >> 8),
+                              (unsigned char)w,         (unsigned char)(h >> 24), (unsigned char)(h >> 16),
+                              (unsigned char)(h >> 8),  (unsigned char)h,         8, 2, 0, 0, 0}; // 8-bit RGB
+    putChunk(png, "IHDR", ihdr, 13, chunkCrc("IHDR", ihdr, 13));
+    for (int b = 0; b < deflateBands; b++) putChunk(png, "IDAT", idat[b].data(), idat[b].size(), crcs[b]);
+    unsigned char trailer[4] = {(unsigned char)(adler >> 24), (unsigned char)(adler >> 16),
+                                (unsigned char)(adler >> 8), (unsigned char)adler};
+    putChunk(png, "IDAT", trailer, 4, chunkCrc("IDAT", trailer, 4));
+    putChunk(png, "IEND", nullptr, 0, chunkCrc("IEND", nullptr, 0));
+    return png;
+}
+
+} // namespace png_encoder
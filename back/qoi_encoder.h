@@ -0,0 +1,69 @@
+#pragma once
+
+// Encoder for QOI, the "Quite OK Image" format (https://qoiformat.org):
+// lossless like PNG but a single cheap pass per pixel, with no entropy
+// coding. Files come out larger than PNG's and encode many times faster.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+namespace qoi_encoder {
+
+// Encodes a w x h 8-bit RGB image, rows top to bottom
+inline std::vector<unsigned char> encode(const unsigned char* rgb, int w, int h) {
+    std::vector<unsigned char> out;
+    out.reserve(14 + size_t(w) * h * 4 + 8); // worst case: a QOI_OP_RGB per pixel
+    auto put32 = [&](uint32_t v) {
+        for (int s = 24; s >= 0; s -= 8) out.push_back((unsigned char)(v >> s));
+    };
+    out.insert(out.end(), {'q', 'o', 'i', 'f'});
+    put32(uint32_t(w));
+    put32(uint32_t(h));
+    out.push_back(3); // RGB
+    out.push_back(0); // sRGB with linear alpha
+
+    // RGBA like the decoder's: a slot nothing was stored in holds (0, 0, 0, 0)
+    // and must not match opaque black
+    unsigned char index[64][4] = {};
+    unsigned char prev[3] = {0, 0, 0};
+    int run = 0;
+    size_t n = size_t(w) * h;
+    for (size_t i = 0; i < n; i++) {
+        const unsigned char* px = rgb + i * 3;
+        if (px[0] == prev[0] && px[1] == prev[1] && px[2] == prev[2]) {
+            if (++run == 62 || i == n - 1) {
+                out.push_back((unsigned char)(0xc0 | (run - 1))); // QOI_OP_RUN
+                run = 0;
+            }
+            continue;
+        }
+        if (run > 0) {
+            out.push_back((unsigned char)(0xc0 | (run - 1)));
+            run = 0;
+        }
+        int slot = (px[0] * 3 + px[1] * 5 + px[2] * 7 + 255 * 11) % 64; // alpha is always 255
+        if (index[slot][0] == px[0] && index[slot][1] == px[1] && index[slot][2] == px[2] && index[slot][3] == 255) {
+            out.push_back((unsigned char)slot); // QOI_OP_INDEX
+        } else {
+            index[slot][0] = px[0], index[slot][1] = px[1], index[slot][2] = px[2], index[slot][3] = 255;
+            signed char dr = (signed char)(px[0] - prev[0]), dg = (signed char)(px[1] - prev[1]),
+                        db = (signed char)(px[2] - prev[2]);
+            int drg = dr - dg, dbg = db - dg;
+            if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                out.push_back((unsigned char)(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2))); // QOI_OP_DIFF
+            } else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7) {
+                out.push_back((unsigned char)(0x80 | (dg + 32))); // QOI_OP_LUMA
+                out.push_back((unsigned char)((drg + 8) << 4 | (dbg + 8)));
+            } else {
+                out.insert(out.end(), {0xfe, px[0], px[1], px[2]}); // QOI_OP_RGB
+            }
+        }
+        prev[0] = px[0], prev[1] = px[1], prev[2] = px[2];
+    }
+    out.insert(out.end(), {0, 0, 0, 0, 0, 0, 0, 1}); // end marker
+    return out;
+}
+
+} // namespace qoi_encoder
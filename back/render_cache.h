@@ -0,0 +1,104 @@
+#pragma once
+
+// Process-wide cache of encoded renders.
+//
+// An entry is addressed by a 64-bit FNV-1a hash of the canonical description
+// of its render (every parameter that changes the output, written in a fixed
+// order and format). The description is kept alongside the bytes and compared
+// on lookup, so a hash collision is a miss rather than a wrong image. Least
+// recently used entries are evicted to stay within the memory budget.
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class RenderCache {
+public:
+    struct Stats {
+        size_t entries;
+        size_t bytes;
+        size_t capacityBytes;
+        unsigned long long hits;
+        unsigned long long misses;
+        unsigned long long evictions;
+    };
+
+    using Bytes = std::shared_ptr<const std::string>;
+
+    explicit RenderCache(size_t capacityBytes) : capacity_(capacityBytes) {}
+
+    RenderCache(const RenderCache&) = delete;
+    RenderCache& operator=(const RenderCache&) = delete;
+
+    // Sizes the cache from RENDER_CACHE_MB (default: 256; 0 disables it)
+    static RenderCache* fromEnv() {
+        size_t mb = 256;
+        if (const char* v = getenv("RENDER_CACHE_MB")) mb = size_t(std::max(0, atoi(v)));
+        return new RenderCache(mb << 20);
+    }
+
+    static uint64_t hash(const std::string& key) {
+        uint64_t h = 0xcbf29ce484222325ull;
+        for (unsigned char c : key) h = (h ^ c) * 0x100000001b3ull;
+        return h;
+    }
+
+    // The bytes stored for key, marked most recently used; null on a miss
+    Bytes get(const std::string& key) {
+        std::lock_guard<std::mutex> lk(m_);
+        auto it = index_.find(hash(key));
+        if (it == index_.end() || it->second->key != key) {
+            misses_++;
+            return nullptr;
+        }
+        hits_++;
+        lru_.splice(lru_.begin(), lru_, it->second);
+        return it->second->bytes;
+    }
+
+    void put(const std::string& key, Bytes bytes) {
+        size_t size = bytes->size() + key.size();
+        uint64_t h = hash(key);
+        std::lock_guard<std::mutex> lk(m_);
+        if (size > capacity_) return;
+        auto it = index_.find(h);
+        if (it != index_.end()) {
+            bytes_ -= it->second->size();
+            lru_.erase(it->second);
+            index_.erase(it);
+        }
+        while (bytes_ + size > capacity_ && !lru_.empty()) {
+            bytes_ -= lru_.back().size();
+            index_.erase(hash(lru_.back().key));
+            lru_.pop_back();
+            evictions_++;
+        }
+        lru_.push_front({key, std::move(bytes)});
+        index_[h] = lru_.begin();
+        bytes_ += size;
+    }
+
+    Stats stats() const {
+        std::lock_guard<std::mutex> lk(m_);
+        return {index_.size(), bytes_, capacity_, hits_, misses_, evictions_};
+    }
+
+private:
+    struct Entry {
+        std::string key;
+        Bytes bytes;
+        size_t size() const { return bytes->size() + key.size(); }
+    };
+
+    mutable std::mutex m_;
+    std::list<Entry> lru_; // most recently used first
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> index_;
+    size_t capacity_;
+    size_t bytes_ = 0;
+    unsigned long long hits_ = 0, misses_ = 0, evictions_ = 0;
+};
@@ -0,0 +1,281 @@
+#pragma once
+
+// Process-wide render executor shared by every HTTP handler.
+//
+// A fixed set of (optionally CPU-pinned) worker threads pulls render jobs from a
+// bounded FIFO queue. Handlers only enqueue jobs, so Crow's I/O threads never
+// path trace. Inside a job, parallelFor() splits its items into contiguous
+// runs, one per worker deque; owners pop their run front to back while idle
+// workers steal from the back of other deques. The calling thread works too,
+// so nested waits cannot deadlock.
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class RenderPool {
+public:
+    struct Stats {
+        unsigned workers;
+        size_t capacity;
+        size_t queued;          // jobs waiting for a worker
+        size_t active;          // jobs currently running
+        unsigned long long completed;
+        unsigned long long rejected;
+        double waitSumMs;       // queue wait of every started job
+        unsigned long long waitCount;
+        double waitMaxMs;
+    };
+
+    RenderPool(unsigned workers, size_t capacity, bool pin)
+        : capacity_(std::max<size_t>(1, capacity)) {
+        std::vector<int> cpus = allowedCpus();
+        workers = std::max(1u, workers);
+        for (unsigned i = 0; i < workers; i++) queues_.emplace_back(new WorkQueue);
+        for (unsigned i = 0; i < workers; i++) {
+            threads_.emplace_back([this, i] { workerLoop(int(i)); });
+            if (pin && !cpus.empty()) {
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(cpus[i % cpus.size()], &set);
+                pthread_setaffinity_np(threads_.back().native_handle(), sizeof(set), &set);
+            }
+        }
+    }
+
+    ~RenderPool() {
+        {
+            std::lock_guard<std::mutex> lk(m_);
+            stop_ = true;
+        }
+        workCv_.notify_all();
+        for (auto& t : threads_) t.join();
+    }
+
+    RenderPool(const RenderPool&) = delete;
+    RenderPool& operator=(const RenderPool&) = delete;
+
+    // Sizes the pool from RENDER_THREADS (default: CPUs this process may run
+    // on), RENDER_QUEUE_DEPTH (default: 16) and RENDER_PIN (default: 1).
+    static RenderPool* fromEnv() {
+        unsigned workers = unsigned(allowedCpus().size());
+        size_t capacity = 16;
+        bool pin = true;
+        if (const char* v = getenv("RENDER_THREADS")) workers = unsigned(std::max(1, atoi(v)));
+        if (const char* v = getenv("RENDER_QUEUE_DEPTH")) capacity = size_t(std::max(1, atoi(v)));
+        if (const char* v = getenv("RENDER_PIN")) pin = atoi(v) != 0;
+        return new RenderPool(workers ? workers : 1, capacity, pin);
+    }
+
+    // Queues job for the next free worker. Returns false without queueing when
+    // the queue already holds `capacity` jobs. The job is passed the time in
+    // milliseconds it spent waiting in the queue.
+    bool submit(std::function<void(double)> job) {
+        {
+            std::lock_guard<std::mutex> lk(m_);
+            if (jobs_.size() >= capacity_) {
+                rejected_++;
+                return false;
+            }
+            jobs_.push_back({std::move(job), Clock::now()});
+        }
+        workCv_.notify_one();
+        return true;
+    }
+
+    // Runs body(i) for every i in [0, count) on the pool and returns when all
+    // of them have finished. Neighbouring indices start on the same worker.
+    void parallelFor(int count, const std::function<void(int)>& body) {
+        if (count <= 0) return;
+        Batch batch{&body, count, {0}};
+        int self = workerIndex();
+        size_t n = queues_.size();
+        for (size_t q = 0; q < n; q++) {
+            // Rotate so the caller's own deque receives the first run
+            size_t target = self >= 0 ? (size_t(self) + q) % n : q;
+            int begin = int(count * q / n), end = int(count * (q + 1) / n);
+            std::lock_guard<std::mutex> lk(queues_[target]->m);
+            for (int i = begin; i < end; i++) queues_[target]->items.push_back({&batch, i});
+        }
+        {
+            std::lock_guard<std::mutex> lk(m_);
+            pendingItems_ += count;
+        }
+        workCv_.notify_all();
+
+        // Help until every item of this batch is done, including stolen ones
+        while (batch.done.load(std::memory_order_acquire) < count) {
+            Item item;
+            if (takeItem(self, item)) {
+                runItem(item);
+                continue;
+            }
+            std::unique_lock<std::mutex> lk(m_);
+            doneCv_.wait(lk, [&] {
+                return batch.done.load(std::memory_order_acquire) == count || pendingItems_ > 0;
+            });
+        }
+    }
+
+    Stats stats() const {
+        std::lock_guard<std::mutex> lk(m_);
+        return {unsigned(threads_.size()), capacity_, jobs_.size(), active_, completed_,
+                rejected_, waitSumMs_, waitCount_, waitMaxMs_};
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Job {
+        std::function<void(double)> fn;
+        Clock::time_point queuedAt;
+    };
+
+    // One parallelFor() call; lives on the caller's stack until done == count
+    struct Batch {
+        const std::function<void(int)>* body;
+        int count;
+        std::atomic<int> done;
+    };
+
+    struct Item {
+        Batch* batch;
+        int index;
+    };
+
+    struct WorkQueue {
+        std::mutex m;
+        std::deque<Item> items;
+    };
+
+    static std::vector<int> allowedCpus() {
+        std::vector<int> cpus;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+            for (int c = 0; c < CPU_SETSIZE; c++)
+                if (CPU_ISSET(c, &set)) cpus.push_back(c);
+        }
+        if (cpus.empty()) {
+            for (unsigned c = 0; c < std::max(1u, std::thread::hardware_concurrency()); c++)
+                cpus.push_back(int(c));
+        }
+        return cpus;
+    }
+
+    // Index of the calling thread in this pool, or -1 for outside threads
+    int workerIndex() const {
+        return tlsPool_ == this ? tlsWorker_ : -1;
+    }
+
+    // Pops from the front of our own deque, else steals from the back of the
+    // others, starting with our neighbour
+    bool takeItem(int self, Item& item) {
+        size_t n = queues_.size();
+        if (self >= 0 && popFront(*queues_[self], item)) return true;
+        for (size_t k = 1; k <= n; k++) {
+            size_t victim = self >= 0 ? (size_t(self) + k) % n : k - 1;
+            if (int(victim) != self && popBack(*queues_[victim], item)) return true;
+        }
+        return false;
+    }
+
+    bool popFront(WorkQueue& q, Item& item) {
+        std::lock_guard<std::mutex> lk(q.m);
+        if (q.items.empty()) return false;
+        item = q.items.front();
+        q.items.pop_front();
+        claimed();
+        return true;
+    }
+
+    bool popBack(WorkQueue& q, Item& item) {
+        std::lock_guard<std::mutex> lk(q.m);
+        if (q.items.empty()) return false;
+        item = q.items.back();
+        q.items.pop_back();
+        claimed();
+        return true;
+    }
+
+    void claimed() {
+        std::lock_guard<std::mutex> lk(m_);
+        pendingItems_--;
+    }
+
+    void runItem(const Item& item) {
+        Batch* batch = item.batch;
+        (*batch->body)(item.index);
+        if (batch->done.fetch_add(1, std::memory_order_acq_rel) + 1 == batch->count) {
+            // The waiter may destroy batch as soon as it sees done == count
+            std::lock_guard<std::mutex> lk(m_);
+            doneCv_.notify_all();
+        }
+    }
+
+    void workerLoop(int self) {
+        tlsPool_ = this;
+        tlsWorker_ = self;
+        for (;;) {
+            // Finish frames already in flight before starting new ones
+            Item item;
+            if (takeItem(self, item)) {
+                runItem(item);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lk(m_);
+            workCv_.wait(lk, [&] { return stop_ || pendingItems_ > 0 || !jobs_.empty(); });
+            if (pendingItems_ > 0) continue;
+            if (jobs_.empty()) return; // stop_ with nothing left to do
+
+            Job job = std::move(jobs_.front());
+            jobs_.pop_front();
+            double waitMs = std::chrono::duration<double, std::milli>(Clock::now() - job.queuedAt).count();
+            waitSumMs_ += waitMs;
+            waitMaxMs_ = std::max(waitMaxMs_, waitMs);
+            waitCount_++;
+            active_++;
+            lk.unlock();
+            try {
+                job.fn(waitMs);
+            } catch (const std::exception& e) {
+                fprintf(stderr, "Render job failed: %s\n", e.what());
+            }
+            lk.lock();
+            active_--;
+            completed_++;
+        }
+    }
+
+    static thread_local RenderPool* tlsPool_;
+    static thread_local int tlsWorker_;
+
+    mutable std::mutex m_;
+    std::condition_variable workCv_, doneCv_;
+    std::deque<Job> jobs_;
+    std::vector<std::unique_ptr<WorkQueue>> queues_;
+    std::vector<std::thread> threads_;
+    long pendingItems_ = 0; // items queued in any deque and not yet claimed
+    size_t capacity_;
+    size_t active_ = 0;
+    unsigned long long completed_ = 0, rejected_ = 0, waitCount_ = 0;
+    double waitSumMs_ = 0, waitMaxMs_ = 0;
+    bool stop_ = false;
+};
+
+inline thread_local RenderPool* RenderPool::tlsPool_ = nullptr;
+inline thread_local int RenderPool::tlsWorker_ = -1;
@@ -0,0 +1,55 @@
+#pragma once
+
+// Counter-based random numbers for the integrators.
+//
+// Every value is a pure function of (pixel, sample, dimension, seed): there is
+// no stream state to thread through the renderer, so any tile, sample range or
+// bounce can be evaluated on any thread or machine and reproduce the same
+// image bit for bit. The key is mixed with the pcg4d hash (Jarzynski & Olano,
+// "Hash Functions for GPU Rendering", JCGT 2020), which only needs 32-bit
+// multiplies, adds, xors and shifts, so batches of keys vectorise on SSE4.1,
+// AVX2 and AVX-512 alike.
+
+#include <stdint.h>
+
+namespace rng {
+
+// Mixes the four words of v in place
+inline void pcg4d(uint32_t v[4]) {
+    for (int i = 0; i < 4; i++) v[i] = v[i] * 1664525u + 1013904223u;
+    v[0] += v[1] * v[3];
+    v[1] += v[2] * v[0];
+    v[2] += v[0] * v[1];
+    v[3] += v[1] * v[2];
+    for (int i = 0; i < 4; i++) v[i] ^= v[i] >> 16;
+    v[0] += v[1] * v[3];
+    v[1] += v[2] * v[0];
+    v[2] += v[0] * v[1];
+    v[3] += v[1] * v[2];
+}
+
+// 53 bits of a hashed key as a double in [0, 1)
+inline double toUnit(const uint32_t v[4]) {
+    return double(int64_t(uint64_t(v[0]) << 21 | v[1] >> 11)) * 0x1p-53; // < 2^53, so signed is exact
+}
+
+inline double uniform(uint32_t pixel, uint32_t sample, uint32_t dim, uint32_t seed) {
+    uint32_t v[4] = {pixel, sample, dim, seed};
+    pcg4d(v);
+    return toUnit(v);
+}
+
+// uniform() for n keys sharing dim and seed. The loop is branch-free over
+// SoA input; GCC clones it for AVX-512, AVX2 and baseline x86-64 and picks
+// one at load time, with results identical on all of them.
+__attribute__((target_clones("avx512f", "avx2", "default")))
+inline void uniformBatch(const uint32_t pixel[], const uint32_t sample[], uint32_t dim, uint32_t seed,
+                         double out[], int n) {
+    for (int i = 0; i < n; i++) {
+        uint32_t v[4] = {pixel[i], sample[i], dim, seed};
+        pcg4d(v);
+        out[i] = toUnit(v);
+    }
+}
+
+} // namespace rng
@@ -0,0 +1,221 @@
+#pragma once
+
+// Sample generators behind the integrators' random numbers.
+//
+// A Sampler maps (pixel, sample, dimension) to a number in [0, 1), like
+// rng::uniform(), but the points of one pixel may be stratified across its
+// samples instead of independent:
+//   random     independent rng::uniform() values
+//   sobol      Owen-scrambled Sobol points, padded in 4D sets with per-set
+//              shuffling (Burley, "Practical Hash-based Owen Scrambling",
+//              JCGT 2020)
+//   halton     Halton points in prime bases, Owen-scrambled digit by digit
+//              per pixel
+//   bluenoise  one Sobol sequence shared by every pixel, toroidally shifted
+//              per pixel by a blue-noise texture, so the remaining error is
+//              spread as high-frequency noise (Georgiev & Fajardo, "Blue-noise
+//              Dithered Sampling", 2016)
+// Only the first kStratifiedDims dimensions (camera and first two bounces)
+// are stratified; by then paths have diverged and deeper dimensions draw
+// rng::uniform() values, which cost a third as much.
+// Every subpixel (sample & 3) is its own sequence indexed by sample >> 2,
+// matching how the renderers number samples. Everything is a pure function
+// of its arguments and the seed, so renders stay independent of scheduling.
+
+#include <math.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <vector>
+
+#include "rng.h"
+
+namespace sampler {
+
+enum Kind { RANDOM, SOBOL, HALTON, BLUE_NOISE };
+
+const int kStratifiedDims = 16, kSobolDims = 4, kBits = 32;
+const int kNoiseSize = 64; // must be a power of 2
+
+inline uint32_t hash(uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+    uint32_t v[4] = {a, b, c, d};
+    rng::pcg4d(v);
+    return v[0];
+}
+
+inline uint32_t reverseBits(uint32_t x) {
+    x = (x << 16) | (x >> 16);
+    x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+    x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+    x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+    x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+    return x;
+}
+
+// Owen scrambling of the bits of x, a different random permutation per seed
+inline uint32_t owenScramble(uint32_t x, uint32_t seed) {
+    x = reverseBits(x);
+    x ^= x * 0x3d20adeau;
+    x += seed;
+    x *= (seed >> 16) | 1;
+    x ^= x * 0x05526c56u;
+    x ^= x * 0x53a22864u;
+    return reverseBits(x);
+}
+
+// Generator matrices of the first kSobolDims Sobol dimensions (Joe-Kuo
+// direction numbers), expanded into one XOR table per index byte: shuffled
+// indices have random bits in all 32 positions, and four lookups beat a
+// bit-by-bit loop.
+struct SobolTables {
+    uint32_t t[kSobolDims][4][256];
+
+    SobolTables() {
+        const int degree[kSobolDims] = {0, 1, 2, 3};
+        const uint32_t poly[kSobolDims] = {0, 0, 1, 1};
+        const uint32_t init[kSobolDims][3] = {{}, {1}, {1, 3}, {1, 3, 1}};
+        uint32_t v[kSobolDims][kBits];
+        for (int k = 0; k < kBits; k++) v[0][k] = 1u << (31 - k);
+        for (int d = 1; d < kSobolDims; d++) {
+            int s = degree[d];
+            for (int k = 0; k < kBits; k++) {
+                if (k < s) {
+                    v[d][k] = init[d][k] << (31 - k);
+                    continue;
+                }
+                v[d][k] = v[d][k - s] ^ (v[d][k - s] >> s);
+                for (int j = 1; j < s; j++)
+                    if (poly[d] >> (s - 1 - j) & 1) v[d][k] ^= v[d][k - j];
+            }
+        }
+        for (int d = 0; d < kSobolDims; d++)
+            for (int byte = 0; byte < 4; byte++)
+                for (int bits = 0; bits < 256; bits++) {
+                    uint32_t x = 0;
+                    for (int k = 0; k < 8; k++)
+                        if (bits >> k & 1) x ^= v[d][8 * byte + k];
+                    t[d][byte][bits] = x;
+                }
+    }
+};
+
+inline const SobolTables &sobolTables() {
+    static const SobolTables tables;
+    return tables;
+}
+
+inline uint32_t sobol(uint32_t index, int dim) {
+    const uint32_t(*t)[256] = sobolTables().t[dim];
+    return t[0][index & 255] ^ t[1][index >> 8 & 255] ^ t[2][index >> 16 & 255] ^ t[3][index >> 24];
+}
+
+inline double toUnit(uint32_t x) { return x * 0x1p-32; }
+
+// Halton bases: the first primes
+const uint32_t kPrimes[kStratifiedDims] = {2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47, 53};
+
+// Radical inverse of index in base, each digit permuted by a random affine map
+// chosen by seed and the digits before it (Owen scrambling). Unlike a plain
+// rotation this keeps the first few points of large bases apart.
+inline double scrambledRadicalInverse(uint32_t index, uint32_t base, uint32_t seed) {
+    double inv = 1. / base, scale = inv, x = 0;
+    for (uint32_t k = 0, prefix = 0; scale > 0x1p-32; k++, scale *= inv) {
+        uint32_t digit = index % base, h = hash(prefix, k, base, seed);
+        uint32_t a = 1 + h % (base - 1), c = (h >> 16) % base; // a != 0, so a bijection mod a prime
+        x += (digit * a + c) % base * scale;
+        prefix = prefix * base + digit;
+        index /= base;
+    }
+    return x;
+}
+
+// kNoiseSize^2 blue-noise ranks in [0, 1), made once by the void-and-cluster
+// method: each pixel in turn goes to the emptiest spot of a Gaussian energy
+// field over those already placed.
+inline const std::vector<float> &blueNoise() {
+    static const std::vector<float> texture = [] {
+        const int n = kNoiseSize, cells = n * n;
+        const double sigma = 1.5;
+        std::vector<double> kernel(cells), energy(cells, 0);
+        for (int y = 0; y < n; y++)
+            for (int x = 0; x < n; x++) {
+                int dx = std::min(x, n - x), dy = std::min(y, n - y);
+                kernel[y * n + x] = exp(-(dx * dx + dy * dy) / (2 * sigma * sigma));
+            }
+        std::vector<float> rank(cells, -1);
+        for (int r = 0; r < cells; r++) {
+            int best = -1;
+            for (int i = 0; i < cells; i++)
+                if (rank[i] < 0 && (best < 0 || energy[i] < energy[best])) best = i;
+            rank[best] = (r + .5f) / cells;
+            int bx = best % n, by = best / n;
+            for (int y = 0; y < n; y++)
+                for (int x = 0; x < n; x++)
+                    energy[y * n + x] += kernel[((y - by) & (n - 1)) * n + ((x - bx) & (n - 1))];
+        }
+        return rank;
+    }();
+    return texture;
+}
+
+class Sampler {
+public:
+    // width: image width, to find a pixel's position in the blue-noise tile
+    Sampler(Kind kind, uint32_t seed, int width) : kind_(kind), seed_(seed), width_(uint32_t(width)) {
+        if (kind_ == SOBOL || kind_ == BLUE_NOISE) sobolTables();
+        if (kind_ == BLUE_NOISE) blueNoise();
+    }
+
+    Kind kind() const { return kind_; }
+
+    double get(uint32_t pixel, uint32_t sample, uint32_t dim) const {
+        uint32_t sub = sample & 3, index = sample >> 2;
+        switch (dim < uint32_t(kStratifiedDims) ? kind_ : RANDOM) {
+        case SOBOL: {
+            uint32_t set = dim / kSobolDims;
+            uint32_t shuffled = owenScramble(index, hash(pixel, sub, set, seed_ ^ 0x5bd1e995u));
+            return toUnit(owenScramble(sobol(shuffled, int(dim % kSobolDims)), hash(pixel, sub, dim, seed_)));
+        }
+        case HALTON: {
+            return scrambledRadicalInverse(index, kPrimes[dim], hash(pixel, sub, dim, seed_));
+        }
+        case BLUE_NOISE: {
+            uint32_t set = dim / kSobolDims, mask = kNoiseSize - 1;
+            uint32_t shuffled = owenScramble(index, hash(set, sub, 0, seed_ ^ 0x5bd1e995u));
+            uint32_t x = sobol(shuffled, int(dim % kSobolDims));
+            uint32_t shift = hash(dim, sub, 1, seed_);
+            uint32_t px = (pixel % width_ + shift) & mask, py = (pixel / width_ + (shift >> 16)) & mask;
+            return toUnit(x + uint32_t(blueNoise()[py * kNoiseSize + px] * 0x1p32));
+        }
+        case RANDOM:
+            break;
+        }
+        return rng::uniform(pixel, sample, dim, seed_);
+    }
+
+    // get() for n keys sharing dim
+    void batch(const uint32_t pixel[], const uint32_t sample[], uint32_t dim, double out[], int n) const {
+        if (kind_ == RANDOM) {
+            rng::uniformBatch(pixel, sample, dim, seed_, out, n);
+            return;
+        }
+        for (int i = 0; i < n; i++) out[i] = get(pixel[i], sample[i], dim);
+    }
+
+private:
+    Kind kind_;
+    uint32_t seed_, width_;
+};
+
+} // namespace sampler
+
+using sampler::Sampler;
+
+// The random numbers of one camera sample: dimension dim of it is
+// sampler->get(pixel, sample, dim)
+struct Rng {
+    uint32_t pixel, sample;
+    const Sampler *sampler;
+
+    double operator()(uint32_t dim) const { return sampler->get(pixel, sample, dim); }
+};
@@ -0,0 +1,60 @@
+#pragma once
+
+// Coalesces concurrent requests for the same work.
+//
+// The first request for a key leads a flight and does the work; requests for
+// the key that arrive before the leader finishes join the flight instead of
+// repeating it, and the leader answers all of them. Once finished, the key is
+// free again, so later requests start a new flight (or find the result in a
+// cache the leader filled before finishing).
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+template <class Waiter>
+class Singleflight {
+public:
+    struct Stats {
+        size_t inFlight;
+        unsigned long long led;    // flights started
+        unsigned long long joined; // requests that rode along on another's flight
+    };
+
+    // Adds w to key's flight. Returns true when w leads it: the caller must do
+    // the work and then call finish(key).
+    bool join(const std::string& key, Waiter w) {
+        std::lock_guard<std::mutex> lk(m_);
+        auto& waiters = flights_[key];
+        waiters.push_back(std::move(w));
+        if (waiters.size() == 1) {
+            led_++;
+            return true;
+        }
+        joined_++;
+        return false;
+    }
+
+    // Ends key's flight; returns its waiters, the leader first
+    std::vector<Waiter> finish(const std::string& key) {
+        std::lock_guard<std::mutex> lk(m_);
+        auto it = flights_.find(key);
+        if (it == flights_.end()) return {};
+        std::vector<Waiter> waiters = std::move(it->second);
+        flights_.erase(it);
+        return waiters;
+    }
+
+    Stats stats() const {
+        std::lock_guard<std::mutex> lk(m_);
+        return {flights_.size(), led_, joined_};
+    }
+
+private:
+    mutable std::mutex m_;
+    std::unordered_map<std::string, std::vector<Waiter>> flights_;
+    unsigned long long led_ = 0, joined_ = 0;
+};
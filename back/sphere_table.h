@@ -0,0 +1,308 @@
+#pragma once
+
+// Structure-of-arrays sphere storage and the ray/sphere intersection kernels.
+//
+// Centers and squared radii live in separate, padded arrays so one ray can be
+// tested against 4 (AVX2) or 8 (AVX-512) spheres per instruction. Packets of up
+// to 16 rays are instead vectorised across rays, one sphere at a time. The kernel is
+// picked once at startup from the CPU's features (override with
+// RENDER_SIMD=scalar|avx2|avx512). Every path performs the same operations in
+// the same order with contraction disabled, so all of them return bit-identical
+// hits and images do not depend on which machine rendered them.
+
+#include <immintrin.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+
+struct SphereTable {
+    static const int kLanes = 8; // arrays are padded to a multiple of the widest kernel
+
+    std::vector<double> cx, cy, cz, rad2; // centers and squared radii
+    std::vector<int> id;                  // index of the sphere in Scene::spheres
+    int count = 0;                        // padded length of every array
+
+    void add(double x, double y, double z, double rad, int sphereId) {
+        cx.push_back(x);
+        cy.push_back(y);
+        cz.push_back(z);
+        rad2.push_back(rad * rad);
+        id.push_back(sphereId);
+    }
+
+    // Pads with spheres no ray can hit; call once after the last add()
+    void finish() {
+        while (cx.size() % kLanes) add(0, 0, 0, 0, -1);
+        for (size_t i = 0; i < rad2.size(); i++)
+            if (id[i] < 0) rad2[i] = -HUGE_VAL;
+        count = int(cx.size());
+    }
+
+    // Closest hit along the ray (o, d); same contract as smallpt's intersect()
+    inline bool intersect(const double o[3], const double d[3], double &t, int &hit) const;
+};
+
+// Up to kMax rays in SoA form; lane l is valid when bit l of a mask is set
+struct RayPacket {
+    static const int kMax = 16;
+    alignas(64) double ox[kMax], oy[kMax], oz[kMax], dx[kMax], dy[kMax], dz[kMax];
+
+    void set(int l, const double o[3], const double d[3]) {
+        ox[l] = o[0], oy[l] = o[1], oz[l] = o[2];
+        dx[l] = d[0], dy[l] = d[1], dz[l] = d[2];
+    }
+};
+
+// Closest hits of the active lanes of p; returns the mask of lanes that hit.
+// Per lane this matches SphereTable::intersect() bit for bit.
+inline unsigned intersectPacket(const SphereTable &tb, const RayPacket &p, unsigned active, double t[], int hit[]);
+
+namespace sphere_kernels {
+
+const double kEps = 1e-4, kInf = 1e20;
+
+// Walks spheres from the last to the first and keeps the first strictly
+// closer hit, so ties resolve to the highest index like the original loop
+inline bool scalar(const SphereTable &tb, const double o[3], const double d[3], double &t, int &hit) {
+    t = kInf;
+    for (int i = tb.count; i--;) {
+        double opx = tb.cx[i] - o[0], opy = tb.cy[i] - o[1], opz = tb.cz[i] - o[2];
+        double b = opx * d[0] + opy * d[1] + opz * d[2];
+        double det = b * b - (opx * opx + opy * opy + opz * opz) + tb.rad2[i];
+        if (det < 0) continue;
+        det = sqrt(det);
+        double s = b - det > kEps ? b - det : (b + det > kEps ? b + det : 0);
+        if (s != 0 && s < t) {
+            t = s;
+            hit = tb.id[i];
+        }
+    }
+    return t < kInf;
+}
+
+__attribute__((target("avx2")))
+inline bool avx2(const SphereTable &tb, const double o[3], const double d[3], double &t, int &hit) {
+    const __m256d ox = _mm256_set1_pd(o[0]), oy = _mm256_set1_pd(o[1]), oz = _mm256_set1_pd(o[2]);
+    const __m256d dx = _mm256_set1_pd(d[0]), dy = _mm256_set1_pd(d[1]), dz = _mm256_set1_pd(d[2]);
+    const __m256d eps = _mm256_set1_pd(kEps), zero = _mm256_setzero_pd();
+    __m256d best = _mm256_set1_pd(kInf), bestIdx = _mm256_set1_pd(-1);
+    for (int i = tb.count - 4; i >= 0; i -= 4) {
+        __m256d opx = _mm256_sub_pd(_mm256_loadu_pd(&tb.cx[i]), ox);
+        __m256d opy = _mm256_sub_pd(_mm256_loadu_pd(&tb.cy[i]), oy);
+        __m256d opz = _mm256_sub_pd(_mm256_loadu_pd(&tb.cz[i]), oz);
+        __m256d b = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(opx, dx), _mm256_mul_pd(opy, dy)), _mm256_mul_pd(opz, dz));
+        __m256d opop = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(opx, opx), _mm256_mul_pd(opy, opy)), _mm256_mul_pd(opz, opz));
+        __m256d det = _mm256_add_pd(_mm256_sub_pd(_mm256_mul_pd(b, b), opop), _mm256_loadu_pd(&tb.rad2[i]));
+        __m256d root = _mm256_sqrt_pd(det); // NaN where det < 0, which fails every compare below
+        __m256d t1 = _mm256_sub_pd(b, root), t2 = _mm256_add_pd(b, root);
+        __m256d s = _mm256_blendv_pd(_mm256_and_pd(t2, _mm256_cmp_pd(t2, eps, _CMP_GT_OQ)), t1,
+                                     _mm256_cmp_pd(t1, eps, _CMP_GT_OQ));
+        __m256d closer = _mm256_and_pd(_mm256_cmp_pd(s, zero, _CMP_NEQ_OQ), _mm256_cmp_pd(s, best, _CMP_LT_OQ));
+        __m256d idx = _mm256_set_pd(i + 3, i + 2, i + 1, i);
+        best = _mm256_blendv_pd(best, s, closer);
+        bestIdx = _mm256_blendv_pd(bestIdx, idx, closer);
+    }
+    alignas(32) double bt[4], bi[4];
+    _mm256_store_pd(bt, best);
+    _mm256_store_pd(bi, bestIdx);
+    t = kInf;
+    int slot = -1;
+    for (int l = 0; l < 4; l++)
+        if (bt[l] < t || (bt[l] == t && bt[l] < kInf && bi[l] > slot)) {
+            t = bt[l];
+            slot = int(bi[l]);
+        }
+    if (slot >= 0) hit = tb.id[slot];
+    return t < kInf;
+}
+
+__attribute__((target("avx512f")))
+inline bool avx512(const SphereTable &tb, const double o[3], const double d[3], double &t, int &hit) {
+    const __m512d ox = _mm512_set1_pd(o[0]), oy = _mm512_set1_pd(o[1]), oz = _mm512_set1_pd(o[2]);
+    const __m512d dx = _mm512_set1_pd(d[0]), dy = _mm512_set1_pd(d[1]), dz = _mm512_set1_pd(d[2]);
+    const __m512d eps = _mm512_set1_pd(kEps), zero = _mm512_setzero_pd();
+    __m512d best = _mm512_set1_pd(kInf), bestIdx = _mm512_set1_pd(-1);
+    for (int i = tb.count - 8; i >= 0; i -= 8) {
+        __m512d opx = _mm512_sub_pd(_mm512_loadu_pd(&tb.cx[i]), ox);
+        __m512d opy = _mm512_sub_pd(_mm512_loadu_pd(&tb.cy[i]), oy);
+        __m512d opz = _mm512_sub_pd(_mm512_loadu_pd(&tb.cz[i]), oz);
+        __m512d b = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(opx, dx), _mm512_mul_pd(opy, dy)), _mm512_mul_pd(opz, dz));
+        __m512d opop = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(opx, opx), _mm512_mul_pd(opy, opy)), _mm512_mul_pd(opz, opz));
+        __m512d det = _mm512_add_pd(_mm512_sub_pd(_mm512_mul_pd(b, b), opop), _mm512_loadu_pd(&tb.rad2[i]));
+        __mmask8 real = _mm512_cmp_pd_mask(det, zero, _CMP_GE_OQ);
+        __m512d root = _mm512_mask_sqrt_pd(zero, real, det);
+        __m512d t1 = _mm512_sub_pd(b, root), t2 = _mm512_add_pd(b, root);
+        __m512d s = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(t2, eps, _CMP_GT_OQ), zero, t2);
+        s = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(t1, eps, _CMP_GT_OQ), s, t1);
+        __mmask8 closer = real & _mm512_cmp_pd_mask(s, zero, _CMP_NEQ_OQ) & _mm512_cmp_pd_mask(s, best, _CMP_LT_OQ);
+        __m512d idx = _mm512_set_pd(i + 7, i + 6, i + 5, i + 4, i + 3, i + 2, i + 1, i);
+        best = _mm512_mask_blend_pd(closer, best, s);
+        bestIdx = _mm512_mask_blend_pd(closer, bestIdx, idx);
+    }
+    alignas(64) double bt[8], bi[8];
+    _mm512_store_pd(bt, best);
+    _mm512_store_pd(bi, bestIdx);
+    t = kInf;
+    int slot = -1;
+    for (int l = 0; l < 8; l++)
+        if (bt[l] < t || (bt[l] == t && bt[l] < kInf && bi[l] > slot)) {
+            t = bt[l];
+            slot = int(bi[l]);
+        }
+    if (slot >= 0) hit = tb.id[slot];
+    return t < kInf;
+}
+
+inline unsigned packetScalar(const SphereTable &tb, const RayPacket &p, unsigned active, double t[], int hit[]) {
+    unsigned hits = 0;
+    for (int l = 0; l < RayPacket::kMax; l++) {
+        if (!(active >> l & 1)) continue;
+        const double o[3] = {p.ox[l], p.oy[l], p.oz[l]}, d[3] = {p.dx[l], p.dy[l], p.dz[l]};
+        if (scalar(tb, o, d, t[l], hit[l])) hits |= 1u << l;
+    }
+    return hits;
+}
+
+__attribute__((target("avx2")))
+inline unsigned packetAvx2(const SphereTable &tb, const RayPacket &p, unsigned active, double t[], int hit[]) {
+    const __m256d eps = _mm256_set1_pd(kEps), zero = _mm256_setzero_pd(), inf = _mm256_set1_pd(kInf);
+    unsigned hits = 0;
+    for (int l = 0; l < RayPacket::kMax; l += 4) {
+        if (!(active >> l & 0xf)) continue;
+        __m256d ox = _mm256_load_pd(&p.ox[l]), oy = _mm256_load_pd(&p.oy[l]), oz = _mm256_load_pd(&p.oz[l]);
+        __m256d dx = _mm256_load_pd(&p.dx[l]), dy = _mm256_load_pd(&p.dy[l]), dz = _mm256_load_pd(&p.dz[l]);
+        __m256d best = inf, bestIdx = _mm256_set1_pd(-1);
+        for (int i = tb.count; i--;) {
+            __m256d opx = _mm256_sub_pd(_mm256_set1_pd(tb.cx[i]), ox);
+            __m256d opy = _mm256_sub_pd(_mm256_set1_pd(tb.cy[i]), oy);
+            __m256d opz = _mm256_sub_pd(_mm256_set1_pd(tb.cz[i]), oz);
+            __m256d b = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(opx, dx), _mm256_mul_pd(opy, dy)), _mm256_mul_pd(opz, dz));
+            __m256d opop = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(opx, opx), _mm256_mul_pd(opy, opy)), _mm256_mul_pd(opz, opz));
+            __m256d det = _mm256_add_pd(_mm256_sub_pd(_mm256_mul_pd(b, b), opop), _mm256_set1_pd(tb.rad2[i]));
+            __m256d root = _mm256_sqrt_pd(det);
+            __m256d t1 = _mm256_sub_pd(b, root), t2 = _mm256_add_pd(b, root);
+            __m256d s = _mm256_blendv_pd(_mm256_and_pd(t2, _mm256_cmp_pd(t2, eps, _CMP_GT_OQ)), t1,
+                                         _mm256_cmp_pd(t1, eps, _CMP_GT_OQ));
+            __m256d closer = _mm256_and_pd(_mm256_cmp_pd(s, zero, _CMP_NEQ_OQ), _mm256_cmp_pd(s, best, _CMP_LT_OQ));
+            best = _mm256_blendv_pd(best, s, closer);
+            bestIdx = _mm256_blendv_pd(bestIdx, _mm256_set1_pd(i), closer);
+        }
+        alignas(32) double bi[4];
+        _mm256_storeu_pd(&t[l], best);
+        _mm256_store_pd(bi, bestIdx);
+        for (int k = 0; k < 4; k++)
+            if ((active >> (l + k) & 1) && bi[k] >= 0) {
+                hit[l + k] = tb.id[int(bi[k])];
+                hits |= 1u << (l + k);
+            }
+    }
+    return hits;
+}
+
+__attribute__((target("avx512f")))
+inline unsigned packetAvx512(const SphereTable &tb, const RayPacket &p, unsigned active, double t[], int hit[]) {
+    const __m512d eps = _mm512_set1_pd(kEps), zero = _mm512_setzero_pd(), inf = _mm512_set1_pd(kInf);
+    unsigned hits = 0;
+    for (int l = 0; l < RayPacket::kMax; l += 8) {
+        __mmask8 lanes = __mmask8(active >> l);
+        if (!lanes) continue;
+        __m512d ox = _mm512_load_pd(&p.ox[l]), oy = _mm512_load_pd(&p.oy[l]), oz = _mm512_load_pd(&p.oz[l]);
+        __m512d dx = _mm512_load_pd(&p.dx[l]), dy = _mm512_load_pd(&p.dy[l]), dz = _mm512_load_pd(&p.dz[l]);
+        __m512d best = inf, bestIdx = _mm512_set1_pd(-1);
+        for (int i = tb.count; i--;) {
+            __m512d opx = _mm512_sub_pd(_mm512_set1_pd(tb.cx[i]), ox);
+            __m512d opy = _mm512_sub_pd(_mm512_set1_pd(tb.cy[i]), oy);
+            __m512d opz = _mm512_sub_pd(_mm512_set1_pd(tb.cz[i]), oz);
+            __m512d b = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(opx, dx), _mm512_mul_pd(opy, dy)), _mm512_mul_pd(opz, dz));
+            __m512d opop = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(opx, opx), _mm512_mul_pd(opy, opy)), _mm512_mul_pd(opz, opz));
+            __m512d det = _mm512_add_pd(_mm512_sub_pd(_mm512_mul_pd(b, b), opop), _mm512_set1_pd(tb.rad2[i]));
+            __mmask8 real = lanes & _mm512_cmp_pd_mask(det, zero, _CMP_GE_OQ);
+            if (!real) continue;
+            __m512d root = _mm512_mask_sqrt_pd(zero, real, det);
+            __m512d t1 = _mm512_sub_pd(b, root), t2 = _mm512_add_pd(b, root);
+            __m512d s = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(t2, eps, _CMP_GT_OQ), zero, t2);
+            s = _mm512_mask_blend_pd(_mm512_cmp_pd_mask(t1, eps, _CMP_GT_OQ), s, t1);
+            __mmask8 closer = real & _mm512_cmp_pd_mask(s, zero, _CMP_NEQ_OQ) & _mm512_cmp_pd_mask(s, best, _CMP_LT_OQ);
+            best = _mm512_mask_blend_pd(closer, best, s);
+            bestIdx = _mm512_mask_blend_pd(closer, bestIdx, _mm512_set1_pd(i));
+        }
+        alignas(64) double bi[8];
+        _mm512_storeu_pd(&t[l], best);
+        _mm512_store_pd(bi, bestIdx);
+        for (int k = 0; k < 8; k++)
+            if ((lanes >> k & 1) && bi[k] >= 0) {
+                hit[l + k] = tb.id[int(bi[k])];
+                hits |= 1u << (l + k);
+            }
+    }
+    return hits;
+}
+
+typedef bool (*Kernel)(const SphereTable &, const double[3], const double[3], double &, int &);
+typedef unsigned (*PacketKernel)(const SphereTable &, const RayPacket &, unsigned, double[], int[]);
+
+inline const char *&chosenName() {
+    static const char *name = "scalar";
+    return name;
+}
+
+inline int &chosenLevel() {
+    static int level = 0; // 0 scalar, 1 avx2, 2 avx512
+    return level;
+}
+
+inline Kernel select() {
+    const char *want = getenv("RENDER_SIMD");
+    __builtin_cpu_init();
+    bool has512 = __builtin_cpu_supports("avx512f"), has2 = __builtin_cpu_supports("avx2");
+    if (want && !strcmp(want, "scalar")) has512 = has2 = false;
+    if (want && !strcmp(want, "avx2")) has512 = false;
+    if (has512) {
+        chosenName() = "avx512";
+        chosenLevel() = 2;
+        return avx512;
+    }
+    if (has2) {
+        chosenName() = "avx2";
+        chosenLevel() = 1;
+        return avx2;
+    }
+    chosenName() = "scalar";
+    chosenLevel() = 0;
+    return scalar;
+}
+
+inline Kernel active() {
+    static const Kernel kernel = select();
+    return kernel;
+}
+
+inline PacketKernel activePacket() {
+    static const PacketKernel kernel = (active(), chosenLevel() == 2   ? packetAvx512
+                                                  : chosenLevel() == 1 ? packetAvx2
+                                                                       : packetScalar);
+    return kernel;
+}
+
+// Name of the kernel intersect() dispatches to
+inline const char *activeName() {
+    active();
+    return chosenName();
+}
+
+} // namespace sphere_kernels
+
+inline bool SphereTable::intersect(const double o[3], const double d[3], double &t, int &hit) const {
+    return sphere_kernels::active()(*this, o, d, t, hit);
+}
+
+inline unsigned intersectPacket(const SphereTable &tb, const RayPacket &p, unsigned active, double t[], int hit[]) {
+    return sphere_kernels::activePacket()(tb, p, active, t, hit);
+}
+
+#pragma GCC pop_options
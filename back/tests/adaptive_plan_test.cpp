@@ -0,0 +1,72 @@
+// planAdaptivePass(): a pass scaled down to its limit still spends it
+
+#include <stdio.h>
+
+#include <vector>
+
+#include "adaptive_plan.h"
+
+static int failures = 0;
+
+static void expect(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+// A frame whose every pixel has taken n samples and is far noisier than any
+// threshold
+static AccumBuffer noisyFrame(int w, int h, uint32_t n) {
+    AccumBuffer acc(w, h);
+    for (int p = 0; p < w * h; p++) {
+        acc.count[p] = n;
+        acc.lum[p] = 4. * n * .5;
+        acc.lum2[p] = 4. * n;
+    }
+    return acc;
+}
+
+static uint64_t planned(const AccumBuffer& acc, const std::vector<uint32_t>& target, bool* withinPass) {
+    uint64_t total = 0;
+    *withinPass = true;
+    for (size_t p = 0; p < target.size(); p++) {
+        if (target[p] < acc.count[p] || target[p] > 2 * acc.count[p]) *withinPass = false;
+        total += target[p] - acc.count[p];
+    }
+    return total;
+}
+
+int main() {
+    const int w = 64, h = 48;
+    AccumBuffer acc = noisyFrame(w, h, 4);
+    std::vector<uint32_t> target(size_t(w) * h);
+    bool withinPass;
+
+    // Unlimited: every pixel doubles
+    expect(planAdaptivePass(acc, 100, 400, .01, UINT64_MAX, target), "unlimited pass planned");
+    expect(planned(acc, target, &withinPass) == uint64_t(4) * w * h, "unlimited pass doubles every pixel");
+
+    // A limit well under a sample per pixel still goes out in full
+    for (uint64_t limit : {1ull, 7ull, 1000ull, 5000ull}) {
+        expect(planAdaptivePass(acc, 100, 400, .01, limit, target), "limited pass planned");
+        uint64_t total = planned(acc, target, &withinPass);
+        if (total + 1 < limit || total > limit) printf("limit %llu: planned %llu\n", limit, (unsigned long long)total);
+        expect(total + 1 >= limit && total <= limit, "limited pass spends its limit");
+        expect(withinPass, "limited pass stays within each pixel's doubling");
+    }
+
+    // The budget left caps the pass like a limit does
+    expect(planAdaptivePass(acc, 5, 400, .01, UINT64_MAX, target), "pass at the end of the budget planned");
+    uint64_t total = planned(acc, target, &withinPass);
+    expect(total + 1 >= uint64_t(w) * h && total <= uint64_t(w) * h, "pass spends what is left of the budget");
+
+    // Quiet pixels and spent budgets need nothing
+    AccumBuffer quiet(w, h);
+    for (int p = 0; p < w * h; p++) quiet.count[p] = 4, quiet.lum[p] = 16, quiet.lum2[p] = 16;
+    expect(!planAdaptivePass(quiet, 100, 400, .01, UINT64_MAX, target), "no pass for a converged frame");
+    expect(!planAdaptivePass(acc, 4, 400, .01, UINT64_MAX, target), "no pass once the budget is spent");
+
+    if (failures == 0) printf("PASS\n");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,65 @@
+// DiskCache: evicted files outlive their grace period only until the next
+// get() or stats(), even when nothing new is put
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include "disk_cache.h"
+
+static int failures = 0;
+
+static void expect(bool ok, const char* what) {
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+static bool exists(const std::string& path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
+
+static std::string fileOf(const std::string& dir, const std::string& key, const char* ext) {
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx", (unsigned long long)RenderCache::hash(key));
+    return dir + name + ext;
+}
+
+int main() {
+    char tmpl[] = "/tmp/disk_cache_test.XXXXXX";
+    std::string dir = mkdtemp(tmpl);
+    const std::chrono::milliseconds grace(200);
+    const std::string image(1000, 'x');
+
+    // Room for one entry: the second put evicts the first
+    DiskCache cache(dir, 1500, grace);
+    cache.put("first", image);
+    cache.put("second", image);
+    expect(cache.get("first").empty(), "first is evicted");
+    expect(exists(fileOf(dir, "first", ".bin")) && exists(fileOf(dir, "first", ".key")),
+           "evicted files stay for the grace period");
+
+    // Past the grace period a lookup alone reaps them
+    std::this_thread::sleep_for(grace * 2);
+    expect(!cache.get("second").empty(), "second is cached");
+    expect(!exists(fileOf(dir, "first", ".bin")) && !exists(fileOf(dir, "first", ".key")),
+           "get() unlinks files past the grace period");
+
+    // ...and so does reading the stats
+    cache.put("third", image);
+    std::this_thread::sleep_for(grace * 2);
+    expect(cache.stats().entries == 1, "one entry left");
+    expect(!exists(fileOf(dir, "second", ".bin")) && !exists(fileOf(dir, "second", ".key")),
+           "stats() unlinks files past the grace period");
+    expect(exists(fileOf(dir, "third", ".bin")), "the cached entry keeps its file");
+
+    system(("rm -rf " + dir).c_str());
+    if (failures == 0) printf("PASS\n");
+    return failures ? 1 : 0;
+}
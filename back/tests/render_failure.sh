@@ -0,0 +1,53 @@
+#!/bin/bash
+
+# A render that throws must still answer every request coalesced onto it and
+# end its flight, so a later identical request renders again instead of
+# waiting forever. The render is made to throw bad_alloc by capping the
+# server's data segment below what a frame needs.
+#
+# Usage: tests/render_failure.sh path/to/render-binary
+
+BIN=${1:?usage: $0 path/to/render-binary}
+PORT=${RENDER_TEST_PORT:-18182}
+URL="http://127.0.0.1:${PORT}/render?samples=1&s1x=31"
+
+RENDER_PORT=$PORT RENDER_THREADS=1 RENDER_PIN=0 MALLOC_ARENA_MAX=1 "$BIN" >/dev/null 2>&1 &
+PID=$!
+OUT=$(mktemp -d)
+trap 'kill $PID 2>/dev/null; rm -rf "$OUT"' EXIT
+for _ in $(seq 50); do
+  curl -s -o /dev/null "http://127.0.0.1:${PORT}/health" && break
+  sleep 0.1
+done
+if ! kill -0 $PID 2>/dev/null; then
+  echo "FAIL: server did not start on port $PORT"
+  exit 1
+fi
+
+# Room for a few more MB, well short of a frame's accumulation buffer
+DATA_KB=$(awk '/^VmData/ {print $2}' /proc/$PID/status)
+prlimit --pid $PID --data=$(( (DATA_KB + 8192) * 1024 )):
+
+fail=0
+expect() {
+  if [ "$2" != "$3" ]; then
+    echo "FAIL: $1: expected $2, got $3"
+    fail=1
+  fi
+}
+
+# Two identical requests share one failing flight; both get an answer
+curl -s -o /dev/null -w '%{http_code}' --max-time 20 "$URL" > "$OUT/first" &
+FIRST=$!
+curl -s -o /dev/null -w '%{http_code}' --max-time 20 "$URL" > "$OUT/second"
+wait $FIRST
+expect "leader of a failed render" 500 "$(cat "$OUT/first")"
+expect "request joined to a failed render" 500 "$(cat "$OUT/second")"
+
+# The failed flight is gone: the same request renders again, and succeeds
+# once there is memory for it
+prlimit --pid $PID --data=unlimited:
+expect "identical request after a failure" 200 "$(curl -s -o /dev/null -w '%{http_code}' --max-time 20 "$URL")"
+
+[ $fail = 0 ] && echo "PASS"
+exit $fail
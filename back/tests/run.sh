@@ -0,0 +1,25 @@
+#!/bin/bash
+
+# Builds the server and the unit tests and runs them all.
+#
+# Usage: tests/run.sh (from anywhere)
+
+cd "$(dirname "$0")/.." || exit 1
+BUILD=$(mktemp -d)
+trap 'rm -rf "$BUILD"' EXIT
+
+g++ main.cpp -o "$BUILD/function" -O2 -pthread -DCROW_USE_BOOST || exit 1
+
+fail=0
+for t in tests/*_test.cpp; do
+  [ -e "$t" ] || continue
+  name=$(basename "$t" .cpp)
+  echo "== $name"
+  g++ "$t" -o "$BUILD/$name" -O2 -pthread -I. && "$BUILD/$name" || fail=1
+done
+for t in tests/*.sh; do
+  [ "$t" = tests/run.sh ] && continue
+  echo "== $(basename "$t" .sh)"
+  bash "$t" "$BUILD/function" || fail=1
+done
+exit $fail
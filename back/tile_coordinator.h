@@ -0,0 +1,233 @@
+#pragma once
+
+// Hands out the tiles of frames rendered across replicas.
+//
+// The replica coordinating a frame starts a job with the frame's tile count
+// and a spec every worker can render a tile from. Workers lease tiles, render
+// them and hand the results back; a tile's first result is applied to the
+// job's frame and later ones are ignored. A lease not answered within the
+// lease timeout (the worker died, hung or lost its connection) puts the tile
+// back in line, and a tile that has been leased maxAttempts times without a
+// result fails its job. Tiles render the same on any replica, so a late
+// result from an expired lease is as good as any. The coordinator also leases
+// tiles of its own jobs to itself; those leases never expire.
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+template <class Frame>
+class TileCoordinator {
+public:
+    struct Stats {
+        size_t jobs;
+        size_t pending;  // tiles waiting for a lease
+        size_t leased;   // tiles being rendered
+        unsigned long long tilesLocal;  // results from the coordinator itself
+        unsigned long long tilesRemote; // results from other replicas
+        unsigned long long expired;     // leases that ran out
+        unsigned long long jobsFailed;
+    };
+
+    struct Lease {
+        uint64_t job;
+        int tile;
+        std::string spec;
+    };
+
+    enum Result { ACCEPTED, DUPLICATE, GONE, REJECTED };
+
+    TileCoordinator(std::chrono::milliseconds leaseTimeout, int maxAttempts)
+        : leaseTimeout_(leaseTimeout), maxAttempts_(std::max(1, maxAttempts)) {}
+
+    TileCoordinator(const TileCoordinator&) = delete;
+    TileCoordinator& operator=(const TileCoordinator&) = delete;
+
+    // Times leases out after RENDER_TILE_LEASE_MS (default: 60000) and fails
+    // a job after RENDER_TILE_ATTEMPTS leases of one tile (default: 4)
+    static TileCoordinator* fromEnv() {
+        int ms = 60000, attempts = 4;
+        if (const char* v = getenv("RENDER_TILE_LEASE_MS")) ms = std::max(1, atoi(v));
+        if (const char* v = getenv("RENDER_TILE_ATTEMPTS")) attempts = atoi(v);
+        return new TileCoordinator(std::chrono::milliseconds(ms), attempts);
+    }
+
+    // Queues the tiles 0..tiles-1 of frame; results are applied to it until
+    // finish(). Returns the job's id.
+    uint64_t start(std::string spec, int tiles, Frame* frame) {
+        std::lock_guard<std::mutex> lk(m_);
+        uint64_t id = ++lastJob_;
+        Job& job = jobs_[id];
+        job.spec = std::move(spec);
+        job.frame = frame;
+        job.tiles.resize(tiles);
+        job.remaining = tiles;
+        for (int t = 0; t < tiles; t++) job.pending.push_back(t);
+        return id;
+    }
+
+    // Leases up to max pending tiles, all of one job, oldest job first
+    std::vector<Lease> lease(size_t max) {
+        std::lock_guard<std::mutex> lk(m_);
+        expire();
+        std::vector<Lease> out;
+        for (auto& it : jobs_) {
+            Job& job = it.second;
+            if (job.failed || job.pending.empty()) continue;
+            while (out.size() < max && !job.pending.empty()) {
+                int t = job.pending.front();
+                job.pending.pop_front();
+                out.push_back(take(it.first, job, t, Clock::now() + leaseTimeout_));
+            }
+            break;
+        }
+        return out;
+    }
+
+    // Leases the next pending tile of job to the coordinator itself
+    bool leaseLocal(uint64_t job, Lease& out) {
+        std::lock_guard<std::mutex> lk(m_);
+        auto it = jobs_.find(job);
+        if (it == jobs_.end() || it->second.failed || it->second.pending.empty()) return false;
+        int t = it->second.pending.front();
+        it->second.pending.pop_front();
+        out = take(job, it->second, t, Clock::time_point::max());
+        return true;
+    }
+
+    // Applies the result of a tile with apply(frame, tile), unless the tile
+    // already has one. apply returns false for a result that does not fit the
+    // tile, which is then REJECTED and the tile stays leased.
+    template <class Apply>
+    Result complete(uint64_t job, int tile, bool local, Apply apply) {
+        std::lock_guard<std::mutex> lk(m_);
+        auto it = jobs_.find(job);
+        if (it == jobs_.end() || it->second.failed) return GONE;
+        Job& j = it->second;
+        if (tile < 0 || tile >= int(j.tiles.size())) return REJECTED;
+        TileState& ts = j.tiles[tile];
+        if (ts.done) return DUPLICATE;
+        if (!apply(*j.frame, tile)) return REJECTED;
+        if (!ts.leased) {
+            // Expired meanwhile: the result still counts
+            auto p = std::find(j.pending.begin(), j.pending.end(), tile);
+            if (p != j.pending.end()) j.pending.erase(p);
+        }
+        ts.done = true;
+        ts.leased = false;
+        j.remaining--;
+        (local ? tilesLocal_ : tilesRemote_)++;
+        if (j.remaining == 0) cv_.notify_all();
+        return ACCEPTED;
+    }
+
+    // Waits up to timeout for job to finish. Returns 1 once every tile has a
+    // result, -1 once a tile ran out of attempts, else 0.
+    int wait(uint64_t job, std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lk(m_);
+        auto it = jobs_.find(job);
+        if (it == jobs_.end()) return -1;
+        cv_.wait_for(lk, timeout, [&] { return it->second.remaining == 0 || it->second.failed; });
+        expire();
+        return it->second.failed ? -1 : it->second.remaining == 0 ? 1 : 0;
+    }
+
+    // Waits up to timeout for any job to have every tile or to fail
+    void waitAny(std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lk(m_);
+        cv_.wait_for(lk, timeout, [&] {
+            for (auto& it : jobs_) {
+                if (it.second.remaining == 0 || it.second.failed) return true;
+            }
+            return false;
+        });
+    }
+
+    // Tiles of job waiting for a lease, expired ones included
+    size_t pending(uint64_t job) {
+        std::lock_guard<std::mutex> lk(m_);
+        expire();
+        auto it = jobs_.find(job);
+        return it == jobs_.end() ? 0 : it->second.pending.size();
+    }
+
+    // Forgets job; results still arriving for it are GONE
+    void finish(uint64_t job) {
+        std::lock_guard<std::mutex> lk(m_);
+        jobs_.erase(job);
+    }
+
+    Stats stats() const {
+        std::lock_guard<std::mutex> lk(m_);
+        size_t pending = 0, leased = 0;
+        for (auto& it : jobs_) {
+            pending += it.second.pending.size();
+            for (const TileState& ts : it.second.tiles) leased += ts.leased;
+        }
+        return {jobs_.size(), pending, leased, tilesLocal_, tilesRemote_, expired_, jobsFailed_};
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct TileState {
+        bool done = false, leased = false;
+        int attempts = 0;
+        Clock::time_point expires;
+    };
+
+    struct Job {
+        std::string spec;
+        Frame* frame;
+        std::vector<TileState> tiles;
+        std::deque<int> pending;
+        int remaining;
+        bool failed = false;
+    };
+
+    Lease take(uint64_t id, Job& job, int t, Clock::time_point expires) {
+        TileState& ts = job.tiles[t];
+        ts.leased = true;
+        ts.attempts++;
+        ts.expires = expires;
+        return {id, t, job.spec};
+    }
+
+    // Puts tiles whose lease ran out back in line, or fails their job
+    void expire() {
+        auto now = Clock::now();
+        for (auto& it : jobs_) {
+            Job& job = it.second;
+            if (job.failed) continue;
+            for (int t = 0; t < int(job.tiles.size()); t++) {
+                TileState& ts = job.tiles[t];
+                if (!ts.leased || ts.expires > now) continue;
+                ts.leased = false;
+                expired_++;
+                if (ts.attempts >= maxAttempts_) {
+                    job.failed = true;
+                    jobsFailed_++;
+                    cv_.notify_all();
+                    break;
+                }
+                job.pending.push_front(t);
+            }
+        }
+    }
+
+    mutable std::mutex m_;
+    std::condition_variable cv_;
+    std::map<uint64_t, Job> jobs_; // oldest first
+    std::chrono::milliseconds leaseTimeout_;
+    int maxAttempts_;
+    uint64_t lastJob_ = 0;
+    unsigned long long tilesLocal_ = 0, tilesRemote_ = 0, expired_ = 0, jobsFailed_ = 0;
+};
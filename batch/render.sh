@@ -7,27 +7,60 @@ S1Z=50
 S2X=60
 S2Y=30
 S2Z=80
-MAX_PARALLEL=2
+FROM=40
+TO=60
 
-# Function to generate one image
-generate() {
-  sleep $((RANDOM % 3))
-  S1X=$1
-  S1Y=$2
-  S1Z=$3
-  S2X=$4
-  S2Y=$5
-  S2Z=$6
-  SAMPLES=$7
-
-  OUTPUT_FILE="x_${S1X}.png"
-  URL="http://localhost:8080/function/render/render?samples=${SAMPLES}&s1x=${S1X}&s1y=${S1Y}&s1z=${S1Z}&s2x=${S2X}&s2y=${S2Y}&s2z=${S2Z}"
-  echo "Rendering s1x=$S1X -> $OUTPUT_FILE"
-  curl -s --http1.1 --max-time 1000 "$URL" -o "$OUTPUT_FILE"
+# One sweep renders every s1x value on the server's pool; its parts arrive
+# as frames finish and are split into x_<s1x>.<ext>
+URL="http://localhost:8080/function/render/render/sweep?param=s1x&from=${FROM}&to=${TO}&samples=${SAMPLES}&s1y=${S1Y}&s1z=${S1Z}&s2x=${S2X}&s2y=${S2Y}&s2z=${S2Z}"
+echo "Rendering s1x=$FROM..$TO"
+curl -s --http1.1 --max-time 1000 --fail-with-body "$URL" -o sweep.body || {
+  echo "Sweep failed: $(cat sweep.body)" >&2
+  rm -f sweep.body
+  exit 1
 }
 
-export -f generate
-
-# Loop over s1x values 20–80 and invoke in parallel
-seq 40 60 | xargs -P "$MAX_PARALLEL" -I {} bash -c \
-  'generate "$@"' _ {} "$S1Y" "$S1Z" "$S2X" "$S2Y" "$S2Z" "$SAMPLES"
+# Every part is "--<boundary>" CRLF, header lines, an empty line, then
+# Content-Length bytes and a CRLF; the last boundary ends with "--"
+header() { sed -n "s/^$1: \(.*\)\r$/\1/p" <<< "$HEADERS"; }
+SIZE=$(wc -c < sweep.body)
+POS=0
+FAILED=0
+while [ "$POS" -lt "$SIZE" ]; do
+  DELIM=$(tail -c +$((POS + 1)) sweep.body | head -n 1 | tr -d '\r')
+  case "$DELIM" in
+    --*--) break ;;
+    --*) ;;
+    *) echo "Malformed sweep response at byte $POS" >&2; FAILED=1; break ;;
+  esac
+  # Offset of the empty line ending the headers, from the part's start
+  END=$(tail -c +$((POS + 1)) sweep.body | head -c 8192 | grep -abo -m 1 $'^\r$' | cut -d: -f1)
+  if [ -z "$END" ]; then
+    echo "Malformed sweep response at byte $POS" >&2
+    FAILED=1
+    break
+  fi
+  HEADERS=$(tail -c +$((POS + 1)) sweep.body | head -c "$END")
+  BODY=$((POS + END + 2))
+  LENGTH=$(header Content-Length)
+  S1X=$((FROM + $(header X-Frame)))
+  if [ "$(header X-Status)" = 200 ]; then
+    case "$(header Content-Type)" in
+      image/png) EXT=png ;;
+      image/jpeg) EXT=jpg ;;
+      image/qoi) EXT=qoi ;;
+      image/x-portable-pixmap) EXT=ppm ;;
+      image/x-portable-arbitrarymap) EXT=pam ;;
+      image/vnd.radiance) EXT=hdr ;;
+      *) EXT=bin ;;
+    esac
+    tail -c +$((BODY + 1)) sweep.body | head -c "$LENGTH" > "x_${S1X}.${EXT}"
+    echo "Rendered s1x=$S1X -> x_${S1X}.${EXT}"
+  else
+    echo "s1x=$S1X failed: $(tail -c +$((BODY + 1)) sweep.body | head -c "$LENGTH")" >&2
+    FAILED=1
+  fi
+  POS=$((BODY + LENGTH + 2))
+done
+rm -f sweep.body
+exit $FAILED
@@ -7,8 +7,13 @@ import (
 	"fmt"
 	"io"
 	"math/rand"
+	"mime"
+	"mime/multipart"
 	"net/http"
 	"os"
+	"sort"
+	"strconv"
+	"strings"
 	"sync"
 	"time"
 )
@@ -29,10 +34,14 @@ type RenderResult struct {
 
 var (
 	jobResults = make(map[string][]RenderResult)
+	jobErrors  = make(map[string]string)
 	jobStatus  = make(map[string]bool)
 	jobMutex   sync.Mutex
 )
 
+// maxSweepFrames is the most frames the back end renders in one sweep
+const maxSweepFrames = 256
+
 func Handle(w http.ResponseWriter, r *http.Request) {
 	if r.Method == http.MethodGet && r.URL.Query().Has("job") {
 		// Return job status
@@ -52,6 +61,7 @@ func Handle(w http.ResponseWriter, r *http.Request) {
 		json.NewEncoder(w).Encode(map[string]interface{}{
 			"status": "complete",
 			"images": jobResults[jobID],
+			"error":  jobErrors[jobID],
 		})
 		return
 	}
@@ -96,26 +106,73 @@ func renderJob(jobID string, req RenderRequest) {
 
 	client := http.Client{Timeout: 10 * time.Minute}
 	results := []RenderResult{}
+	errors := []string{}
 
-	for s1x := req.S1XStart; s1x <= req.S1XEnd; s1x++ {
+	// One sweep request per maxSweepFrames frames; parts arrive in completion order
+	for from := req.S1XStart; from <= req.S1XEnd; from += maxSweepFrames {
+		to := from + maxSweepFrames - 1
+		if to > req.S1XEnd {
+			to = req.S1XEnd
+		}
 		url := fmt.Sprintf(
-			os.Getenv("BACK_URL")+"/render?samples=%d&s1x=%d&s1y=%d&s1z=%d&s2x=%d&s2y=%d&s2z=%d",
-			req.Samples, s1x, s1y, s1z, s2x, s2y, s2z,
+			os.Getenv("BACK_URL")+"/render/sweep?param=s1x&from=%d&to=%d&samples=%d&s1y=%d&s1z=%d&s2x=%d&s2y=%d&s2z=%d",
+			from, to, req.Samples, s1y, s1z, s2x, s2y, s2z,
 		)
-
-		resp, err := client.Get(url)
-		if err != nil || resp.StatusCode != 200 {
-			continue
+		batch, err := renderSweep(client, url, from)
+		results = append(results, batch...)
+		if err != nil {
+			errors = append(errors, fmt.Sprintf("s1x %d-%d: %v", from, to, err))
 		}
-		imgData, _ := io.ReadAll(resp.Body)
-		resp.Body.Close()
-
-		dataURL := "data:image/png;base64," + base64.StdEncoding.EncodeToString(imgData)
-		results = append(results, RenderResult{S1X: s1x, ImgData: dataURL})
 	}
+	sort.Slice(results, func(i, j int) bool { return results[i].S1X < results[j].S1X })
 
 	jobMutex.Lock()
 	jobResults[jobID] = results
+	jobErrors[jobID] = strings.Join(errors, "; ")
 	jobStatus[jobID] = true
 	jobMutex.Unlock()
 }
+
+// renderSweep fetches one sweep whose first frame has s1x = from. It returns
+// the frames that rendered, and an error when the sweep or any frame failed.
+func renderSweep(client http.Client, url string, from int) ([]RenderResult, error) {
+	resp, err := client.Get(url)
+	if err != nil {
+		return nil, err
+	}
+	defer resp.Body.Close()
+	if resp.StatusCode != http.StatusOK {
+		msg, _ := io.ReadAll(io.LimitReader(resp.Body, 512))
+		return nil, fmt.Errorf("%s: %s", resp.Status, strings.TrimSpace(string(msg)))
+	}
+
+	results := []RenderResult{}
+	failed := 0
+	_, params, _ := mime.ParseMediaType(resp.Header.Get("Content-Type"))
+	parts := multipart.NewReader(resp.Body, params["boundary"])
+	for {
+		part, err := parts.NextPart()
+		if err == io.EOF {
+			break
+		}
+		if err != nil {
+			return results, err
+		}
+		frame, _ := strconv.Atoi(part.Header.Get("X-Frame"))
+		imgData, err := io.ReadAll(part)
+		if err != nil {
+			return results, err
+		}
+		// The part's own status, whatever format the frame was encoded in
+		if status := part.Header.Get("X-Status"); status != "" && status != "200" {
+			failed++
+			continue
+		}
+		dataURL := "data:" + part.Header.Get("Content-Type") + ";base64," + base64.StdEncoding.EncodeToString(imgData)
+		results = append(results, RenderResult{S1X: from + frame, ImgData: dataURL})
+	}
+	if failed > 0 {
+		return results, fmt.Errorf("%d frames failed", failed)
+	}
+	return results, nil
+}